@@ -4,3 +4,4 @@ Release\FrustumCulling.exe -p ../stats/part_of_pompeii.01.final.combined.camrout
 Release\FrustumCulling.exe -p ../stats/part_of_pompeii.01.final.combined.camroute -s scenes/part_of_pompeii.01.final.combined.obj -q -u 0.001 -c 100 -m ../stats/part_of_pompeii.01.final.combined_100_cm.stats -no-plane-coherency -no-octant-test
 Release\FrustumCulling.exe -p ../stats/part_of_pompeii.01.final.combined.camroute -s scenes/part_of_pompeii.01.final.combined.obj -q -u 0.001 -c 100 -m ../stats/part_of_pompeii.01.final.combined_100_c.stats -no-octant-test -no-plane-masking -no-plane-coherency
 Release\FrustumCulling.exe -p ../stats/part_of_pompeii.01.final.combined.camroute -s scenes/part_of_pompeii.01.final.combined.obj -q -u 0.001 -c 100 -m ../stats/part_of_pompeii.01.final.combined_100_.stats -no-frustum-culling
+Release\FrustumCulling.exe -p ../stats/part_of_pompeii.01.final.combined.camroute -s scenes/part_of_pompeii.01.final.combined.obj -q -u 0.001 -c 100 -m ../stats/part_of_pompeii.01.final.combined_100_colmf.stats -front-to-back
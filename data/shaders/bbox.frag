@@ -0,0 +1,7 @@
+#version 450 core
+out vec4 fColor;
+
+void main() {
+	// only used for occlusion queries with color writes disabled
+	fColor = vec4(1);
+}
@@ -0,0 +1,11 @@
+#version 450 core
+layout(location = 0) in vec3 vPosition; // unit cube
+
+uniform mat4 ModelViewProject;
+uniform vec3 BoxMin;
+uniform vec3 BoxSize;
+
+void main()
+{
+	gl_Position = ModelViewProject*vec4(BoxMin + vPosition*BoxSize, 1);
+}
@@ -1,11 +1,16 @@
 #version 450 core
 out vec4 fColor;
-uniform vec3 CameraPos;
+layout(std140, binding = 0) uniform Frame
+{
+	mat4 ViewProject;
+	vec3 CameraPos;
+};
 
 in Vertex
 {
 	vec3 worldPosition;
 	vec3 normal;
+	flat uint materialIndex;
 };
 
 struct Material {
@@ -15,7 +20,11 @@ struct Material {
 	float specularK;
 	float shininess;
 };
-uniform Material Mat;
+
+layout(std430, binding = 5) readonly buffer Materials
+{
+	Material materials[];
+};
 
 vec3 lightColor = vec3(1,1,1);
 
@@ -24,6 +33,6 @@ void main() {
 	float d = dot(L,normal);
 	// the light is at camera position so it is always shining at the visible side of the face
 	d *= sign(d);
-	float di = Mat.diffuseK*d;
+	float di = materials[materialIndex].diffuseK*d;
 	fColor = vec4(clamp(di*lightColor, 0,1), 1);
 }
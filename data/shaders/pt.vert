@@ -1,21 +1,53 @@
 #version 450 core
 layout(location = 0) in vec3 vPosition;
-layout(location = 1) in vec3 vNormal;
+layout(location = 1) in vec3 vNormal; // only xy if the normals are octahedral-encoded
+layout(location = 2) in uint vMaterial; // per draw (instanced by the base instance), index into the materials of the object
 
 out Vertex
 {
 	vec3 worldPosition;
 	vec3 normal;
+	flat uint materialIndex;
 };
 
-uniform mat4 ViewProject;
-uniform mat4 Model;
-uniform mat4 ModelInvT;
+layout(std140, binding = 0) uniform Frame
+{
+	mat4 ViewProject;
+	vec3 CameraPos;
+};
+
+struct ObjectData {
+	mat4 model;
+	mat4 modelInvT;
+	uint firstMaterial; // the materials of the object start here in the Materials block
+	vec3 positionOffset; // the position is decoded as offset + position*scale
+	bool octahedralNormals;
+	vec3 positionScale;
+};
+
+layout(std430, binding = 4) readonly buffer Objects
+{
+	ObjectData objects[];
+};
+uniform uint ObjectIndex;
+
+// inverse of octahedralEncode in object.cpp
+vec3 octahedralDecode(vec2 e)
+{
+	vec3 n = vec3(e, 1 - abs(e.x) - abs(e.y));
+	if(n.z < 0)
+		n.xy = (1 - abs(e.yx))*mix(vec2(-1), vec2(1), greaterThanEqual(e, vec2(0)));
+	return normalize(n);
+}
 
 void main()
 {
-	vec4 p = Model*vec4(vPosition.xyz,1);
-	normal = normalize((ModelInvT*vec4(vNormal.xyz,0)).xyz);
+	ObjectData o = objects[ObjectIndex];
+	vec3 position = o.positionOffset + vPosition*o.positionScale;
+	vec3 n = o.octahedralNormals ? octahedralDecode(vNormal.xy) : vNormal;
+	vec4 p = o.model*vec4(position,1);
+	normal = normalize((o.modelInvT*vec4(n,0)).xyz);
 	worldPosition = p.xyz;
+	materialIndex = o.firstMaterial + vMaterial;
 	gl_Position = ViewProject*p;
 }
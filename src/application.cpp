@@ -4,6 +4,7 @@
 #include <cctype>
 #include <map>
 #include <chrono>
+#include <cmath>
 #include "libs.hpp"
 #include "utils.hpp"
 #include "application.hpp"
@@ -11,8 +12,12 @@
 #include "object.hpp"
 #include "globals.hpp"
 #include "circularBuffer.hpp"
+#include "ringBuffer.hpp"
 
 static const float CAMERA_PLAY_SPEED = 100;
+static const float PVS_DEFAULT_CELL_SIZE = 50;
+static const unsigned PVS_DEFAULT_RAYS_PER_CELL = 100000;
+static const float VISIBLE_SET_CACHE_DEFAULT_BUDGET = 256; // [MB]
 
 Application& Application::instance(int argc, char* argv[]) {
 	static Application instance(argc, argv);
@@ -30,7 +35,8 @@ Application::Application(int argc, char* argv[]):
 	_cameraPlaySpeed{0},
 	_quitAfterPlayback{false},
 	_cameraPlayPaused{false},
-	_cameraPlaybackUniformStepSize{0}
+	_cameraPlaybackUniformStepSize{0},
+	_sceneObject{nullptr}
 {
 	using namespace std;
 	glutInit(&argc, argv);
@@ -86,6 +92,12 @@ Application::~Application() {
 		else
 			std::cerr << "Failed to save camera route.\n";
 	}
+	if(!_visibleSetCacheFileName.empty()) {
+		if(_sceneObject->saveVisibleSetCache(_visibleSetCacheFileName))
+			std::cout << "Visible set cache saved.\n";
+		else
+			std::cerr << "Failed to save visible set cache.\n";
+	}
 }
 
 void Application::processArgs(int argc, char* argv[]) {
@@ -106,8 +118,31 @@ void Application::processArgs(int argc, char* argv[]) {
 	if(argMap.count("c") != 0) {
 		MAX_PRIMITIVES_IN_LEAF = stof(argMap["c"]);
 	}
+	// the proxies are built when the object is loaded
+	if(argMap.count("lod")) {
+		LOD_ENABLED = true;
+		if(!argMap["lod"].empty())
+			LOD_PIXEL_ERROR_THRESHOLD = stof(argMap["lod"]);
+	}
+	if(argMap.count("vertex-cache-optimization"))
+		VERTEX_CACHE_OPTIMIZATION_ENABLED = true;
+	if(argMap.count("compress-vertices"))
+		VERTEX_COMPRESSION_ENABLED = true;
+	// the meshlets are built when the object is loaded
+	if(argMap.count("meshlets")) {
+		MESHLET_CULLING_ENABLED = true;
+		MESHLET_TRIANGLE_COUNT = argMap["meshlets"].empty() ? 128 : stoi(argMap["meshlets"]);
+	}
+	if(argMap.count("triangle-culling")) {
+		TRIANGLE_CULLING_ENABLED = true;
+		if(!argMap["triangle-culling"].empty())
+			TRIANGLE_CULLING_MIN_LEAF_SIZE = stoi(argMap["triangle-culling"]);
+	}
+	if(argMap.count("leaf-vertex-ranges"))
+		LEAF_VERTEX_RANGES_ENABLED = true;
 	if(argMap.count("s") != 0) {
 		Object& o = _scene->addObject("../data/"+argMap["s"]);
+		_sceneObject = &o;
 		_scene->getCamera().setPosition(
 				glm::vec3(
 					o.getTransform() * glm::vec4(o.getAABB().centroid(), 1.0))
@@ -149,7 +184,10 @@ void Application::processArgs(int argc, char* argv[]) {
 		initialT = stof(argMap["t"]);
 	}
 	if(argMap.count("p")) {
-		_cameraRoute.load(argMap["p"]);
+		if(!_cameraRoute.load(argMap["p"])) {
+			cerr << "Could not load camera route " << argMap["p"] << ".\n";
+			exit(1);
+		}
 		_cameraPlayLineNode = _cameraRoute.getNode(initialT);
 		_scene->getCamera().setPosition(_cameraPlayLineNode.position);
 		_scene->getCamera().setLookDir(_cameraPlayLineNode.direction);
@@ -157,6 +195,35 @@ void Application::processArgs(int argc, char* argv[]) {
 		if(initialT)
 			_cameraPlayPaused = true;
 	}
+	if(argMap.count("pvs-build")) {
+		if(!argMap.count("p")) {
+			cerr << "PVS can only be built for a camera route (-p).\n";
+			exit(1);
+		}
+		float cellSize = argMap.count("pvs-cell-size") ? stof(argMap["pvs-cell-size"]) : PVS_DEFAULT_CELL_SIZE;
+		unsigned raysPerCell = argMap.count("pvs-rays") ? stoi(argMap["pvs-rays"]) : PVS_DEFAULT_RAYS_PER_CELL;
+		// sample the route densely enough not to skip any view cell
+		float routeLength = _cameraRoute.getNode(1).distance;
+		unsigned stepCount = std::max(1u, unsigned(std::ceil(routeLength/(cellSize/4))));
+		std::vector<glm::vec3> routePoints;
+		for(unsigned i = 0; i <= stepCount; ++i)
+			routePoints.push_back(_cameraRoute.getNode(float(i)/stepCount).position);
+		cout << "Building PVS ...\n";
+		auto start = chrono::steady_clock::now();
+		if(!_sceneObject->buildPVS(routePoints, cellSize, raysPerCell, argMap["pvs-build"])) {
+			cerr << "Failed to save PVS to " << argMap["pvs-build"] << ".\n";
+			exit(1);
+		}
+		cout << "PVS built in " << chrono::duration_cast<chrono::seconds>(chrono::steady_clock::now()-start).count() << " s\n";
+		exit(0);
+	}
+	if(argMap.count("pvs")) {
+		if(!_sceneObject->loadPVS(argMap["pvs"])) {
+			cerr << "Could not load PVS " << argMap["pvs"] << ".\n";
+			exit(1);
+		}
+		PVS_ENABLED = true;
+	}
 	if(argMap.count("r"))
 		_cameraRouteOutFileName = argMap["r"];
 	if(argMap.count("q"))
@@ -178,6 +245,66 @@ void Application::processArgs(int argc, char* argv[]) {
 		PLANE_COHERENCY_ENABLED = false;
 	if(argMap.count("no-camera-coherency"))
 		CAMERA_COHERENCY_ENABLED = false;
+	if(argMap.count("no-range-coalescing"))
+		DRAW_RANGE_COALESCING_ENABLED = false;
+	if(argMap.count("visible-set-cache")) {
+		VISIBLE_SET_CACHE_ENABLED = true;
+		std::stringstream ss(argMap["visible-set-cache"]);
+		float budget = VISIBLE_SET_CACHE_DEFAULT_BUDGET;
+		if(!(ss >> budget))
+			ss.clear();
+		_sceneObject->setVisibleSetCacheBudget(size_t(budget*1024*1024));
+		ss >> _visibleSetCacheFileName;
+		if(!_visibleSetCacheFileName.empty()) {
+			if(_sceneObject->loadVisibleSetCache(_visibleSetCacheFileName))
+				cout << "Visible set cache loaded.\n";
+			else
+				cout << "Visible set cache " << _visibleSetCacheFileName << " could not be loaded, starting empty.\n";
+		}
+	}
+	if(argMap.count("guard-band")) {
+		GUARD_BAND_CACHING_ENABLED = true;
+		std::stringstream ss(argMap["guard-band"]);
+		float angle, margin;
+		if(ss >> angle) {
+			GUARD_BAND_ANGLE = glm::radians(angle);
+			if(ss >> margin)
+				GUARD_BAND_MARGIN = margin;
+		}
+	}
+	if(argMap.count("camera-relative"))
+		CAMERA_RELATIVE_CULLING_ENABLED = true;
+	if(argMap.count("front-to-back"))
+		FRONT_TO_BACK_ORDERING_ENABLED = true;
+	if(argMap.count("merge-gap"))
+		DRAW_RANGE_MERGE_GAP = stoi(argMap["merge-gap"]);
+	if(argMap.count("occlusion-culling")) {
+		OCCLUSION_CULLING_ENABLED = true;
+		if(!argMap["occlusion-culling"].empty())
+			OCCLUDER_TRIANGLE_BUDGET = stoi(argMap["occlusion-culling"]);
+	}
+	if(argMap.count("speculative-culling"))
+		SPECULATIVE_CULLING_ENABLED = true;
+	if(argMap.count("gpu-occlusion-culling"))
+		GPU_OCCLUSION_CULLING_ENABLED = true;
+	if(argMap.count("gpu-culling"))
+		GPU_FRUSTUM_CULLING_ENABLED = true;
+	if(argMap.count("gpu-culling-validate")) {
+		GPU_FRUSTUM_CULLING_ENABLED = true;
+		GPU_CULLING_VALIDATION_ENABLED = true;
+	}
+	if(argMap.count("no-normal-cone-culling"))
+		NORMAL_CONE_CULLING_ENABLED = false;
+	if(argMap.count("small-feature-culling")) {
+		SMALL_FEATURE_CULLING_ENABLED = true;
+		SMALL_FEATURE_PIXEL_THRESHOLD = stof(argMap["small-feature-culling"]);
+	}
+	if(argMap.count("exact-culling"))
+		EXACT_CULLING_ENABLED = true;
+	if(argMap.count("multi-draw-indirect"))
+		MULTI_DRAW_INDIRECT_ENABLED = true;
+	if(argMap.count("multi-view"))
+		MULTI_VIEW_COUNT = std::max(1, stoi(argMap["multi-view"]));
 }
 
 void Application::displayStats() {
@@ -186,6 +313,8 @@ void Application::displayStats() {
 	static CircularBuffer<float> drawTimeCirc(circSize);
 	static CircularBuffer<float> travTimeCirc(circSize);
 	static CircularBuffer<float> frameTimeCirc(circSize);
+	static CircularBuffer<float> multiViewTravTimeCirc(circSize);
+	static CircularBuffer<float> independentViewsTravTimeCirc(circSize);
 	static auto lastUpdate = chrono::steady_clock::now();
 
 	if(chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now()-lastUpdate).count() > 200) {
@@ -193,6 +322,8 @@ void Application::displayStats() {
 		drawTimeCirc.add(_scene->totalObjectGPUDrawTime());
 		travTimeCirc.add(FC_TRAVERSE_TIME);
 		frameTimeCirc.add(_frameTime);
+		multiViewTravTimeCirc.add(FC_MULTI_VIEW_TRAVERSE_TIME);
+		independentViewsTravTimeCirc.add(FC_INDEPENDENT_VIEWS_TRAVERSE_TIME);
 	}
 
 	stringstream ss;
@@ -201,10 +332,60 @@ void Application::displayStats() {
 	ss << "Draw time [ms]: " << drawTimeCirc.avg() << endl;
 	ss << "Triangles rendered / total: " << _scene->totalObjectTrianglesRendered() << " / " << _scene->triangleCount() << endl;
 	ss << "Culling time [ms]: " << travTimeCirc.avg() << endl;
+	ss << "Draw calls: " << FC_DRAW_CALL_COUNT << endl;
+	if(MULTI_VIEW_COUNT > 1)
+		ss << MULTI_VIEW_COUNT << " views culling time single pass / independent [ms]: " << multiViewTravTimeCirc.avg() << " / " << independentViewsTravTimeCirc.avg() << endl;
 	ss << "Visited node count / total: " << FC_NODE_VISITED_COUNT << " / " << FC_NODE_COUNT << endl;
+	if(OCCLUSION_CULLING_ENABLED) {
+		ss << "Occluder triangles / occlusion culled triangles: " << FC_OCCLUDER_TRIANGLE_COUNT << " / " << FC_OCCLUSION_CULLED_TRIANGLE_COUNT << endl;
+		ss << "Occlusion culling time [ms]: " << FC_OCCLUSION_TIME << endl;
+	}
+	if(VISIBLE_SET_CACHE_ENABLED)
+		ss << "Visible set cache hits / misses: " << FC_VISIBLE_SET_CACHE_HIT_COUNT << " / " << FC_VISIBLE_SET_CACHE_MISS_COUNT << endl;
+	if(GUARD_BAND_CACHING_ENABLED) {
+		// fraction of the recent frames which had to be culled again
+		static float recullRate = 0;
+		recullRate = 0.95f*recullRate + 0.05f*(FC_GUARD_BAND_RECULL_COUNT > 0);
+		ss << "Guard band re-culls / rate: " << FC_GUARD_BAND_RECULL_COUNT << " / " << recullRate << endl;
+	}
+	if(SPECULATIVE_CULLING_ENABLED)
+		ss << "Speculative culling time [ms] / misses: " << FC_SPECULATIVE_TRAVERSE_TIME << " / " << FC_SPECULATIVE_CULLING_MISS_COUNT << endl;
+	if(PVS_ENABLED)
+		ss << "PVS culled triangles: " << FC_PVS_CULLED_TRIANGLE_COUNT << endl;
+	if(LOD_ENABLED)
+		ss << "LOD nodes / triangles / draw time [ms]: " << FC_LOD_NODE_COUNT << " / " << FC_LOD_TRIANGLE_COUNT << " / " << _scene->totalObjectLodDrawTime() << endl;
+	if(GPU_FRUSTUM_CULLING_ENABLED) {
+		ss << "GPU culled visible leaves: " << FC_GPU_CULLING_VISIBLE_LEAF_COUNT;
+		if(GPU_CULLING_VALIDATION_ENABLED)
+			ss << " (CPU mismatches " << FC_GPU_CULLING_MISMATCH_COUNT << ")";
+		ss << endl;
+	}
+	if(GPU_OCCLUSION_CULLING_ENABLED)
+		ss << "Occlusion queries / stalls / culled triangles: " << FC_OCCLUSION_QUERY_COUNT << " / " << FC_OCCLUSION_QUERY_WAIT_COUNT << " / " << FC_OCCLUSION_CULLED_TRIANGLE_COUNT << endl;
+	if(BF_CULLING_ENABLED && NORMAL_CONE_CULLING_ENABLED)
+		ss << "Normal cone culled triangles: " << FC_NORMAL_CONE_CULLED_TRIANGLE_COUNT << endl;
+	if(SMALL_FEATURE_CULLING_ENABLED)
+		ss << "Small feature culled triangles: " << FC_SMALL_FEATURE_CULLED_TRIANGLE_COUNT << endl;
+	if(MESHLET_CULLING_ENABLED)
+		ss << "Meshlet culled triangles: " << FC_MESHLET_CULLED_TRIANGLE_COUNT << endl;
+	if(TRIANGLE_CULLING_ENABLED)
+		ss << "Triangle culled triangles / time [ms]: " << FC_TRIANGLE_CULLED_TRIANGLE_COUNT << " / " << FC_TRIANGLE_CULLING_TIME << endl;
+	if(EXACT_CULLING_ENABLED)
+		ss << "Exact tests / triangles culled: " << FC_EXACT_TEST_COUNT << " / " << FC_EXACT_TEST_CULLED_TRIANGLE_COUNT << endl;
 	ss << "Tree depth: " << FC_TREE_DEPTH << endl;
 	ss << "Max tris per leaf: " << MAX_PRIMITIVES_IN_LEAF << endl;
-	ss << "Backface culling: " << BF_CULLING_ENABLED << endl;
+	ss << "Backface culling: " << BF_CULLING_ENABLED;
+	if(BF_CULLING_ENABLED && NORMAL_CONE_CULLING_ENABLED)
+		ss << " (+ normal cones)";
+	ss << endl;
+	ss << "Multi-draw indirect: " << MULTI_DRAW_INDIRECT_ENABLED << endl;
+	ss << "Vertex cache optimization: " << VERTEX_CACHE_OPTIMIZATION_ENABLED << endl;
+	ss << "Compressed vertices: " << VERTEX_COMPRESSION_ENABLED << endl;
+	ss << "Leaf vertex ranges: " << LEAF_VERTEX_RANGES_ENABLED << endl;
+	ss << "Draw range coalescing: " << DRAW_RANGE_COALESCING_ENABLED;
+	if(DRAW_RANGE_COALESCING_ENABLED)
+		ss << " (max gap " << DRAW_RANGE_MERGE_GAP << " tris)";
+	ss << endl;
 	ss << "VF culling: " << FRUSTUM_CULLING_ENABLED;
 	if(FRUSTUM_CULLING_ENABLED) {
 		ss << "(";
@@ -216,6 +397,34 @@ void Application::displayStats() {
 			ss << " + plane coh.";
 		if(CAMERA_COHERENCY_ENABLED)
 			ss << " + camera coh.";
+		if(VISIBLE_SET_CACHE_ENABLED)
+			ss << " + visible set cache";
+		if(GUARD_BAND_CACHING_ENABLED)
+			ss << " + guard band";
+		if(FRONT_TO_BACK_ORDERING_ENABLED)
+			ss << " + front-to-back";
+		if(CAMERA_RELATIVE_CULLING_ENABLED)
+			ss << " + camera relative";
+		if(EXACT_CULLING_ENABLED)
+			ss << " + exact t.";
+		if(MESHLET_CULLING_ENABLED)
+			ss << " + meshlets";
+		if(TRIANGLE_CULLING_ENABLED)
+			ss << " + triangles (leaves >= " << TRIANGLE_CULLING_MIN_LEAF_SIZE << ")";
+		if(SMALL_FEATURE_CULLING_ENABLED)
+			ss << " + small feature (" << SMALL_FEATURE_PIXEL_THRESHOLD << " px)";
+		if(PVS_ENABLED)
+			ss << " + PVS";
+		if(LOD_ENABLED)
+			ss << " + LOD (" << LOD_PIXEL_ERROR_THRESHOLD << " px)";
+		if(SPECULATIVE_CULLING_ENABLED)
+			ss << " + speculative";
+		if(GPU_OCCLUSION_CULLING_ENABLED)
+			ss << " + CHC++ occlusion";
+		else if(GPU_FRUSTUM_CULLING_ENABLED)
+			ss << " + GPU traversal";
+		else if(OCCLUSION_CULLING_ENABLED)
+			ss << " + occlusion";
 		ss << ")";
 	}
 	ss << endl;
@@ -225,43 +434,83 @@ void Application::displayStats() {
 void Application::display() {
 	FC_NODE_VISITED_COUNT = 0;
 	FC_TRAVERSE_TIME = 0;
+	FC_DRAW_CALL_COUNT = 0;
+	FC_SMALL_FEATURE_CULLED_TRIANGLE_COUNT = 0;
+	FC_NORMAL_CONE_CULLED_TRIANGLE_COUNT = 0;
+	FC_OCCLUDER_TRIANGLE_COUNT = 0;
+	FC_OCCLUSION_CULLED_TRIANGLE_COUNT = 0;
+	FC_OCCLUSION_TIME = 0;
+	FC_OCCLUSION_QUERY_COUNT = 0;
+	FC_OCCLUSION_QUERY_WAIT_COUNT = 0;
+	FC_PVS_CULLED_TRIANGLE_COUNT = 0;
+	FC_SPECULATIVE_CULLING_MISS_COUNT = 0;
+	FC_SPECULATIVE_TRAVERSE_TIME = 0;
+	FC_LOD_NODE_COUNT = 0;
+	FC_LOD_TRIANGLE_COUNT = 0;
+	FC_GUARD_BAND_RECULL_COUNT = 0;
+	FC_VISIBLE_SET_CACHE_HIT_COUNT = 0;
+	FC_VISIBLE_SET_CACHE_MISS_COUNT = 0;
+	FC_GPU_CULLING_VISIBLE_LEAF_COUNT = 0;
+	FC_GPU_CULLING_MISMATCH_COUNT = 0;
+	FC_MESHLET_CULLED_TRIANGLE_COUNT = 0;
+	FC_TRIANGLE_CULLED_TRIANGLE_COUNT = 0;
+	FC_TRIANGLE_CULLING_TIME = 0;
+	FC_EXACT_TEST_COUNT = 0;
+	FC_EXACT_TEST_CULLED_TRIANGLE_COUNT = 0;
+	FC_MULTI_VIEW_TRAVERSE_TIME = 0;
+	FC_INDEPENDENT_VIEWS_TRAVERSE_TIME = 0;
 	glClearColor(0, 0, 0, 1);
 	glEnable(GL_DEPTH_TEST);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	frameUploadBuffer().beginFrame();
 	instance()._scene->render();
 	instance().displayStats();
+	frameUploadBuffer().endFrame();
 	glutSwapBuffers();
 }
 
 void Application::moveCamera() {
+	moveCamera(_scene->getCamera(), _cameraPlayLineNode, _frameTime);
+	if(!SPECULATIVE_CULLING_ENABLED) {
+		_scene->clearPredictedCamera();
+		return;
+	}
+	// The next frame is expected to take as long as this one and the held keys not to change.
+	// The uniform playback steps (-u) are predicted exactly, a wrong prediction is culled again when it is drawn.
+	Camera predicted = _scene->getCamera();
+	PolyLineNode predictedPlayLineNode = _cameraPlayLineNode;
+	moveCamera(predicted, predictedPlayLineNode, _frameTime);
+	_scene->setPredictedCamera(predicted);
+}
+
+void Application::moveCamera(Camera& cam, PolyLineNode& playLineNode, float timeStep) {
 	const float rotSpeed = 1.0f;
-	Camera& cam = _scene->getCamera();
 	glm::vec3 forward = cam.getLookDir();
 	glm::vec3 up = cam.getUpVector();
 	if(_keyDown[(unsigned char)'q'])
-		cam.rotateHoriz(rotSpeed*_frameTime);
+		cam.rotateHoriz(rotSpeed*timeStep);
 	if(_keyDown[(unsigned char)'e'])
-		cam.rotateHoriz(-rotSpeed*_frameTime);
+		cam.rotateHoriz(-rotSpeed*timeStep);
 	if(_keyDown[(unsigned char)'a'])
-		cam.move(-glm::normalize(glm::cross(forward,up))*_frameTime*_cameraSpeed);
+		cam.move(-glm::normalize(glm::cross(forward,up))*timeStep*_cameraSpeed);
 	if(_keyDown[(unsigned char)'d'])
-		cam.move(glm::normalize(glm::cross(forward,up))*_frameTime*_cameraSpeed);
+		cam.move(glm::normalize(glm::cross(forward,up))*timeStep*_cameraSpeed);
 	if(_keyDown[(unsigned char)'w'])
-		cam.move(forward*_frameTime*_cameraSpeed);
+		cam.move(forward*timeStep*_cameraSpeed);
 	if(_keyDown[(unsigned char)'s'])
-		cam.move(-forward*_frameTime*_cameraSpeed);
+		cam.move(-forward*timeStep*_cameraSpeed);
 	if(_keyDown[(unsigned char)'k'])
-		cam.move(up*_frameTime*_cameraSpeed);
+		cam.move(up*timeStep*_cameraSpeed);
 	if(_keyDown[(unsigned char)'j'])
-		cam.move(-up*_frameTime*_cameraSpeed);
+		cam.move(-up*timeStep*_cameraSpeed);
 
 	if(_cameraPlaySpeed != 0 && !_cameraPlayPaused) {
 		if(_cameraPlaybackUniformStepSize)
-			_cameraPlayLineNode = _cameraRoute.getNode(std::min(1.f, _cameraPlayLineNode.t + _cameraPlaybackUniformStepSize));
+			playLineNode = _cameraRoute.getNode(std::min(1.f, playLineNode.t + _cameraPlaybackUniformStepSize));
 		else
-			_cameraPlayLineNode = _cameraRoute.getNode(_cameraPlayLineNode, _cameraPlaySpeed*_frameTime);
-		cam.setPosition(_cameraPlayLineNode.position);
-		cam.setLookDir(_cameraPlayLineNode.direction);
+			playLineNode = _cameraRoute.getNode(playLineNode, _cameraPlaySpeed*timeStep);
+		cam.setPosition(playLineNode.position);
+		cam.setLookDir(playLineNode.direction);
 	}
 }
 
@@ -298,6 +547,57 @@ void Application::onKeyPressed(unsigned char key) {
 		case 'c':
 			CAMERA_COHERENCY_ENABLED = !CAMERA_COHERENCY_ENABLED;
 			break;
+		case 'x':
+			EXACT_CULLING_ENABLED = !EXACT_CULLING_ENABLED;
+			break;
+		case 'g':
+			DRAW_RANGE_COALESCING_ENABLED = !DRAW_RANGE_COALESCING_ENABLED;
+			break;
+		case 'z':
+			SMALL_FEATURE_CULLING_ENABLED = !SMALL_FEATURE_CULLING_ENABLED;
+			break;
+		case 'n':
+			NORMAL_CONE_CULLING_ENABLED = !NORMAL_CONE_CULLING_ENABLED;
+			break;
+		case 'h':
+			OCCLUSION_CULLING_ENABLED = !OCCLUSION_CULLING_ENABLED;
+			break;
+		case 'v':
+			GPU_OCCLUSION_CULLING_ENABLED = !GPU_OCCLUSION_CULLING_ENABLED;
+			break;
+		case 'i':
+			PVS_ENABLED = !PVS_ENABLED;
+			break;
+		case 'u':
+			SPECULATIVE_CULLING_ENABLED = !SPECULATIVE_CULLING_ENABLED;
+			break;
+		case 't':
+			LOD_ENABLED = !LOD_ENABLED;
+			break;
+		case 'y':
+			FRONT_TO_BACK_ORDERING_ENABLED = !FRONT_TO_BACK_ORDERING_ENABLED;
+			break;
+		case '4':
+			MULTI_DRAW_INDIRECT_ENABLED = !MULTI_DRAW_INDIRECT_ENABLED;
+			break;
+		case '3':
+			VISIBLE_SET_CACHE_ENABLED = !VISIBLE_SET_CACHE_ENABLED;
+			break;
+		case '2':
+			GUARD_BAND_CACHING_ENABLED = !GUARD_BAND_CACHING_ENABLED;
+			break;
+		case '5':
+			GPU_FRUSTUM_CULLING_ENABLED = !GPU_FRUSTUM_CULLING_ENABLED;
+			break;
+		case '6':
+			MESHLET_CULLING_ENABLED = !MESHLET_CULLING_ENABLED;
+			break;
+		case '7':
+			TRIANGLE_CULLING_ENABLED = !TRIANGLE_CULLING_ENABLED;
+			break;
+		case '1':
+			CAMERA_RELATIVE_CULLING_ENABLED = !CAMERA_RELATIVE_CULLING_ENABLED;
+			break;
 	}
 }
 
@@ -311,6 +611,32 @@ void Application::logFrameStats() {
 		 << FC_NODE_VISITED_COUNT << " "
 		 << FC_NODE_COUNT << " "
 		 << FC_TRAVERSE_TIME << " "
+		 << FC_MULTI_VIEW_TRAVERSE_TIME << " "
+		 << FC_INDEPENDENT_VIEWS_TRAVERSE_TIME << " "
+		 << FC_EXACT_TEST_COUNT << " "
+		 << FC_EXACT_TEST_CULLED_TRIANGLE_COUNT << " "
+		 << FC_DRAW_CALL_COUNT << " "
+		 << FC_SMALL_FEATURE_CULLED_TRIANGLE_COUNT << " "
+		 << FC_NORMAL_CONE_CULLED_TRIANGLE_COUNT << " "
+		 << FC_OCCLUDER_TRIANGLE_COUNT << " "
+		 << FC_OCCLUSION_CULLED_TRIANGLE_COUNT << " "
+		 << FC_OCCLUSION_TIME << " "
+		 << FC_OCCLUSION_QUERY_COUNT << " "
+		 << FC_OCCLUSION_QUERY_WAIT_COUNT << " "
+		 << FC_PVS_CULLED_TRIANGLE_COUNT << " "
+		 << FC_SPECULATIVE_TRAVERSE_TIME << " "
+		 << FC_SPECULATIVE_CULLING_MISS_COUNT << " "
+		 << FC_LOD_NODE_COUNT << " "
+		 << FC_LOD_TRIANGLE_COUNT << " "
+		 << _scene->totalObjectLodDrawTime() << " "
+		 << FC_GUARD_BAND_RECULL_COUNT << " "
+		 << FC_VISIBLE_SET_CACHE_HIT_COUNT << " "
+		 << FC_VISIBLE_SET_CACHE_MISS_COUNT << " "
+		 << FC_GPU_CULLING_VISIBLE_LEAF_COUNT << " "
+		 << FC_GPU_CULLING_MISMATCH_COUNT << " "
+		 << FC_MESHLET_CULLED_TRIANGLE_COUNT << " "
+		 << FC_TRIANGLE_CULLED_TRIANGLE_COUNT << " "
+		 << FC_TRIANGLE_CULLING_TIME << " "
 		 << std::endl;
 		if(!_statsOutFile)
 			std::cerr << "Writing frame stats failed\n";
@@ -26,9 +26,14 @@ class Application {
 
 		/** Move the camera based on which keys are being held down.
 		 * Should be called every frame
+		 * With speculative culling it also predicts the camera of the next frame.
 		 */
 		void moveCamera();
 
+		/** Moves the camera by the held keys and the playback by the time step.
+		 */
+		void moveCamera(Camera& cam, PolyLineNode& playLineNode, float timeStep);
+
 		/** This function is called once when a key is pressed.
 		 * @param a GLUT character code of the pressed key
 		 */
@@ -67,5 +72,8 @@ class Application {
 		bool _quitAfterPlayback;
 		bool _cameraPlayPaused;
 		float _cameraPlaybackUniformStepSize;
+
+		Object* _sceneObject;
+		std::string _visibleSetCacheFileName; /// loaded at start (if it exists) and saved at exit
 };
 #endif /* APPLICATION_HPP_19_04_21_09_04_19 */
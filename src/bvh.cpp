@@ -1,9 +1,14 @@
 #include <stack>
 #include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <atomic>
+#include <thread>
 #include "bvh.hpp"
 #include "containment.hpp"
 #include "globals.hpp"
+#include "lod.hpp"
+#include "vertexCache.hpp"
 
 std::vector<unsigned> BVH::build(const std::vector<Vertex>& vertices, const std::vector<PrimitiveInfo>& primitivesInfo, unsigned maxPrimitivesInLeaf) {
 	std::vector<unsigned> primitives(primitivesInfo.size());
@@ -30,6 +35,7 @@ std::vector<unsigned> BVH::build(const std::vector<Vertex>& vertices, const std:
 				nodePrimsEnd,
 				n->bounds,
 				centroidAABB);
+		n->normalCone = primitivesNormalCone(primitivesInfo, nodePrimsBegin, nodePrimsEnd);
 		if(n->primitiveCount > maxPrimitivesInLeaf) {
 			unsigned short splittingAxis = 0;
 			glm::vec3 extents = centroidAABB.max-centroidAABB.min;
@@ -41,6 +47,7 @@ std::vector<unsigned> BVH::build(const std::vector<Vertex>& vertices, const std:
 			auto secondGroupBegin = std::partition(nodePrimsBegin, nodePrimsEnd, [&](unsigned primitiveIndex){
 					return primitivesInfo[primitiveIndex].centroid[splittingAxis] < splitVal;
 					});
+			n->splitAxis = splittingAxis;
 			BVHBuildNode *l = new BVHBuildNode,
 									 *r = new BVHBuildNode;
 			n->children[0].reset(l);
@@ -57,23 +64,249 @@ std::vector<unsigned> BVH::build(const std::vector<Vertex>& vertices, const std:
 		}
 	}
 	compress(std::move(root));
+	if(MESHLET_TRIANGLE_COUNT > 0)
+		buildMeshlets(vertices, primitivesInfo, primitives, MESHLET_TRIANGLE_COUNT);
+	groupLeafMaterials(primitivesInfo, primitives);
+	if(VERTEX_CACHE_OPTIMIZATION_ENABLED)
+		optimizeLeafVertexCache(primitivesInfo, primitives);
+	selectOccluders(vertices, primitivesInfo, primitives);
 	return primitives;
 }
 
+static const unsigned ACMR_CACHE_SIZE = 16; // FIFO cache simulated to report the vertex cache efficiency
+
+void BVH::buildMeshlets(const std::vector<Vertex>& vertices, const std::vector<PrimitiveInfo>& primitivesInfo, std::vector<unsigned>& primitives, unsigned meshletTriangleCount) {
+	_meshlets.clear();
+	_nodeMeshlets.assign(_nodes.size(), {0, 0});
+	std::stack<NodePrimitives> ranges;
+	for(unsigned n = 0; n < _nodes.size(); ++n) {
+		if(!isLeaf(n) || _nodePrimitives[n].count <= meshletTriangleCount)
+			continue;
+		_nodeMeshlets[n].first = _meshlets.size();
+		ranges.push(_nodePrimitives[n]);
+		while(!ranges.empty()) {
+			NodePrimitives r = ranges.top();
+			ranges.pop();
+			auto begin = primitives.begin() + r.first;
+			auto end = begin + r.count;
+			Meshlet m;
+			AABB centroidAABB;
+			primitivesAndCentroidsAABB(vertices, primitivesInfo, begin, end, m.bounds, centroidAABB);
+			if(r.count <= meshletTriangleCount) {
+				m.primitives = r;
+				m.centroid = m.bounds.centroid();
+				m.boundingSphereRadius = glm::length(m.centroid-m.bounds.min);
+				m.normalCone = primitivesNormalCone(primitivesInfo, begin, end);
+				_meshlets.push_back(m);
+				continue;
+			}
+			// the halves are pushed in reverse, so the meshlets are stored in the primitive order
+			glm::vec3 extents = centroidAABB.max-centroidAABB.min;
+			unsigned axis = extents.y > extents.x ? 1 : 0;
+			if(extents.z > extents[axis])
+				axis = 2;
+			unsigned half = r.count/2;
+			std::nth_element(begin, begin+half, end, [&](unsigned a, unsigned b) {
+					return primitivesInfo[a].centroid[axis] < primitivesInfo[b].centroid[axis];
+					});
+			ranges.push({r.first+half, r.count-half});
+			ranges.push({r.first, half});
+		}
+		_nodeMeshlets[n].count = _meshlets.size() - _nodeMeshlets[n].first;
+	}
+}
+
+std::vector<NodePrimitives> BVH::leafClusters() const {
+	std::vector<NodePrimitives> clusters;
+	for(unsigned n = 0; n < _nodes.size(); ++n) {
+		if(!isLeaf(n))
+			continue;
+		if(!_nodeMeshlets.empty() && _nodeMeshlets[n].count > 0)
+			for(unsigned m = _nodeMeshlets[n].first; m < _nodeMeshlets[n].first + _nodeMeshlets[n].count; ++m)
+				clusters.push_back(_meshlets[m].primitives);
+		else
+			clusters.push_back(_nodePrimitives[n]);
+	}
+	return clusters;
+}
+
+void BVH::groupLeafMaterials(const std::vector<PrimitiveInfo>& primitivesInfo, std::vector<unsigned>& primitives) const {
+	for(const NodePrimitives& c : leafClusters())
+		std::stable_sort(primitives.begin()+c.first, primitives.begin()+c.first+c.count, [&](unsigned a, unsigned b) {
+				return primitivesInfo[a].material < primitivesInfo[b].material;
+				});
+}
+
+void BVH::optimizeLeafVertexCache(const std::vector<PrimitiveInfo>& primitivesInfo, std::vector<unsigned>& primitives) const {
+	// each material group of a cluster is reordered on its own
+	std::vector<NodePrimitives> clusters;
+	for(const NodePrimitives& c : leafClusters())
+		for(unsigned first = c.first; first < c.first + c.count;) {
+			unsigned end = first+1;
+			while(end < c.first + c.count && primitivesInfo[primitives[end]].material == primitivesInfo[primitives[first]].material)
+				++end;
+			clusters.push_back({first, end-first});
+			first = end;
+		}
+	std::atomic<unsigned> nextCluster{0};
+	std::atomic<unsigned> missCountBefore{0};
+	std::atomic<unsigned> missCountAfter{0};
+	auto processLeaves = [&]() {
+		std::vector<unsigned> indices, leafPrimitives;
+		for(unsigned i; (i = nextCluster++) < clusters.size();) {
+			// the clusters do not overlap, so each thread writes its own part of the primitives
+			const NodePrimitives& r = clusters[i];
+			leafPrimitives.assign(primitives.begin()+r.first, primitives.begin()+r.first+r.count);
+			indices.clear();
+			for(unsigned p : leafPrimitives)
+				indices.insert(indices.end(), primitivesInfo[p].indices, primitivesInfo[p].indices+3);
+			missCountBefore += vertexCacheMissCount(indices, ACMR_CACHE_SIZE);
+			std::vector<unsigned> order = vertexCacheOptimizedOrder(indices);
+			indices.clear();
+			for(unsigned j = 0; j < order.size(); ++j) {
+				primitives[r.first+j] = leafPrimitives[order[j]];
+				indices.insert(indices.end(), primitivesInfo[primitives[r.first+j]].indices, primitivesInfo[primitives[r.first+j]].indices+3);
+			}
+			missCountAfter += vertexCacheMissCount(indices, ACMR_CACHE_SIZE);
+		}
+	};
+	std::vector<std::thread> threads(std::max(1u, std::thread::hardware_concurrency()));
+	for(std::thread& t : threads)
+		t = std::thread(processLeaves);
+	for(std::thread& t : threads)
+		t.join();
+	std::cout << "Vertex cache ACMR (FIFO " << ACMR_CACHE_SIZE << "): " << float(missCountBefore)/primitives.size()
+		<< " -> " << float(missCountAfter)/primitives.size() << "\n";
+}
+
+static const unsigned OCCLUDERS_PER_NODE = 32;
+
+void BVH::selectOccluders(const std::vector<Vertex>& vertices, const std::vector<PrimitiveInfo>& primitivesInfo, const std::vector<unsigned>& primitives) {
+	std::vector<float> area(primitives.size());
+	for(unsigned i = 0; i < primitives.size(); ++i) {
+		const PrimitiveInfo& info = primitivesInfo[primitives[i]];
+		const glm::vec3& v0 = vertices[info.indices[0]].position;
+		const glm::vec3& v1 = vertices[info.indices[1]].position;
+		const glm::vec3& v2 = vertices[info.indices[2]].position;
+		float a = glm::length(glm::cross(v1-v0, v2-v0))/2;
+		// slivers cover almost no pixels - compare the area to the area of an equilateral triangle with the same edge lengths
+		float edgeLengthsSq = glm::dot(v1-v0, v1-v0) + glm::dot(v2-v1, v2-v1) + glm::dot(v0-v2, v0-v2);
+		float fatness = edgeLengthsSq > 0 ? 4*std::sqrt(3.f)*a/edgeLengthsSq : 0;
+		area[i] = fatness > 0.1f ? a : 0;
+	}
+	auto largerFirst = [&](unsigned p1, unsigned p2){ return area[p1] > area[p2]; };
+
+	// children follow their parent in the node array, so going backwards processes the children first
+	std::vector<std::vector<unsigned>> nodeOccluders(_nodes.size());
+	std::vector<unsigned> candidates;
+	for(unsigned n = _nodes.size(); n-- > 0;) {
+		candidates.clear();
+		if(isLeaf(n))
+			for(unsigned p = _nodePrimitives[n].first; p < _nodePrimitives[n].first + _nodePrimitives[n].count; ++p) {
+				if(area[p] > 0)
+					candidates.push_back(p);
+			}
+		else
+			for(unsigned child : {n+1, _nodes[n].rightChild})
+				candidates.insert(candidates.end(), nodeOccluders[child].begin(), nodeOccluders[child].end());
+		unsigned count = std::min<unsigned>(OCCLUDERS_PER_NODE, candidates.size());
+		std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end(), largerFirst);
+		nodeOccluders[n].assign(candidates.begin(), candidates.begin() + count);
+	}
+
+	_nodeOccluders.clear();
+	_occluderPrimitives.clear();
+	for(const std::vector<unsigned>& occluders : nodeOccluders) {
+		float occludersArea = 0;
+		for(unsigned p : occluders)
+			occludersArea += area[p];
+		_nodeOccluders.push_back({unsigned(_occluderPrimitives.size()), unsigned(occluders.size()), occludersArea});
+		_occluderPrimitives.insert(_occluderPrimitives.end(), occluders.begin(), occluders.end());
+	}
+}
+
+void BVH::buildProxies(
+		const std::vector<Vertex>& vertices,
+		const std::vector<PrimitiveInfo>& primitivesInfo,
+		const std::vector<unsigned>& primitives,
+		unsigned proxyTriangleCount,
+		std::vector<Vertex>& lodVertices,
+		std::vector<unsigned>& lodIndices)
+{
+	struct Mesh {
+		std::vector<glm::vec3> positions;
+		std::vector<unsigned> indices;
+		float error = 0;
+	};
+	// children follow their parent in the node array, so going backwards processes the children first
+	// each node is represented by its proxy or by its (children's) input if it has none
+	std::vector<Mesh> nodeMeshes(_nodes.size());
+	std::vector<Mesh> proxies(_nodes.size());
+	for(unsigned n = _nodes.size(); n-- > 0;) {
+		Mesh& mesh = nodeMeshes[n];
+		if(isLeaf(n)) {
+			for(unsigned p = _nodePrimitives[n].first; p < _nodePrimitives[n].first + _nodePrimitives[n].count; ++p)
+				for(unsigned i : primitivesInfo[primitives[p]].indices) {
+					mesh.indices.push_back(mesh.positions.size());
+					mesh.positions.push_back(vertices[i].position);
+				}
+			continue;
+		}
+		for(unsigned child : {n+1, _nodes[n].rightChild}) {
+			Mesh& c = nodeMeshes[child];
+			for(unsigned i : c.indices)
+				mesh.indices.push_back(i + mesh.positions.size());
+			mesh.positions.insert(mesh.positions.end(), c.positions.begin(), c.positions.end());
+			mesh.error = std::max(mesh.error, c.error);
+			c = Mesh();
+		}
+		if(mesh.indices.size()/3 <= proxyTriangleCount)
+			continue;
+		unsigned inputTriangleCount = mesh.indices.size()/3;
+		mesh.error += simplifyMesh(mesh.positions, mesh.indices, proxyTriangleCount);
+		if(mesh.indices.size()/3 < inputTriangleCount)
+			proxies[n] = mesh;
+	}
+
+	_nodeProxies.assign(_nodes.size(), NodeProxy{{0, 0}, 0});
+	for(unsigned n = 0; n < _nodes.size(); ++n) {
+		const Mesh& proxy = proxies[n];
+		if(proxy.indices.empty())
+			continue;
+		_nodeProxies[n] = {{unsigned(lodIndices.size()/3), unsigned(proxy.indices.size()/3)}, proxy.error};
+		unsigned firstVertex = lodVertices.size();
+		std::vector<glm::vec3> normals(proxy.positions.size(), glm::vec3(0));
+		for(unsigned t = 0; t < proxy.indices.size(); t += 3) {
+			const glm::vec3& v0 = proxy.positions[proxy.indices[t+0]];
+			const glm::vec3& v1 = proxy.positions[proxy.indices[t+1]];
+			const glm::vec3& v2 = proxy.positions[proxy.indices[t+2]];
+			glm::vec3 areaWeightedNormal = glm::cross(v1-v0, v2-v0);
+			for(unsigned i = 0; i < 3; ++i)
+				normals[proxy.indices[t+i]] += areaWeightedNormal;
+		}
+		for(unsigned v = 0; v < proxy.positions.size(); ++v) {
+			float length = glm::length(normals[v]);
+			lodVertices.push_back({proxy.positions[v], length > 0 ? normals[v]/length : glm::vec3(0, 0, 1)});
+		}
+		for(unsigned i : proxy.indices)
+			lodIndices.push_back(firstVertex + i);
+	}
+}
+
 void BVH::compress(BVHBuildNode&& root) {
 	std::stack<BVHBuildNode*> nodes;
 	nodes.push(&root);
-	auto addNode = [&](const AABB& bounds, unsigned firstPrimitive, unsigned primitiveCount){
-		_nodes.push_back({bounds, unsigned(-1), 0, bounds.centroid(), glm::length(bounds.centroid()-bounds.min)});
-		_nodePrimitives.push_back({firstPrimitive, primitiveCount});
+	auto addNode = [&](const BVHBuildNode& n){
+		_nodes.push_back({n.bounds, unsigned(-1), 0, n.splitAxis, n.bounds.centroid(), glm::length(n.bounds.centroid()-n.bounds.min), n.normalCone});
+		_nodePrimitives.push_back({n.firstPrimitive, n.primitiveCount});
 	};
-	addNode(root.bounds, root.firstPrimitive, root.primitiveCount);
+	addNode(root);
 	root.compressedNodeI = 0;
 	while(!nodes.empty()) {
 		BVHBuildNode* n = nodes.top();
 		if(n->children[0]) {
 			n = n->children[0].get();
-			addNode(n->bounds, n->firstPrimitive, n->primitiveCount);
+			addNode(*n);
 			n->compressedNodeI = _nodes.size()-1;
 			nodes.push(n);
 		}
@@ -84,7 +317,7 @@ void BVH::compress(BVHBuildNode&& root) {
 			if(!nodes.empty()) {
 				_nodes[nodes.top()->compressedNodeI].rightChild = _nodes.size();
 				n = nodes.top()->children[1].get();
-				addNode(n->bounds, n->firstPrimitive, n->primitiveCount);
+				addNode(*n);
 				n->compressedNodeI = _nodes.size()-1;
 				nodes.pop();
 				nodes.push(n);
@@ -112,6 +345,26 @@ void BVH::primitivesAndCentroidsAABB(
 	}
 }
 
+NormalCone BVH::primitivesNormalCone(
+		const std::vector<PrimitiveInfo>& primitivesInfo,
+		std::vector<unsigned>::iterator primitiveIndexBegin,
+		std::vector<unsigned>::iterator primitiveIndexEnd) {
+	NormalCone cone = {glm::vec3(0), -1, 0};
+	glm::vec3 normalSum(0);
+	for(auto it = primitiveIndexBegin; it != primitiveIndexEnd; ++it)
+		normalSum += primitivesInfo[*it].normal;
+	float l = glm::length(normalSum);
+	if(l < std::numeric_limits<float>::epsilon())
+		return cone;
+	cone.axis = normalSum/l;
+	cone.cosAngle = 1;
+	for(auto it = primitiveIndexBegin; it != primitiveIndexEnd; ++it)
+		if(primitivesInfo[*it].normal != glm::vec3(0)) // degenerate primitives are never rasterized
+			cone.cosAngle = std::min(cone.cosAngle, glm::dot(cone.axis, primitivesInfo[*it].normal));
+	cone.sinAngle = std::sqrt(std::max(0.f, 1-cone.cosAngle*cone.cosAngle));
+	return cone;
+}
+
 PlaneMask octantToFrustumPlaneMask(const glm::vec3& point, const Plane& octantPlaneTop, const Plane& octantPlaneFront, const Plane& octantPlaneRight) {
 	glm::vec4 p(point, 1);
 	float dTop   = glm::dot(p, octantPlaneTop);
@@ -133,24 +386,107 @@ PlaneMask octantToFrustumPlaneMask(const glm::vec3& point, const Plane& octantPl
 	return r;
 }
 
-const std::vector<unsigned>& BVH::nodesInFrustum(const std::vector<Plane>& frustumPlanes, const glm::vec3& frustumCenter, const glm::vec3& lookDir, const glm::vec3& up) {
-	Plane octantPlaneFront = planeFromNormalAndPoint(lookDir, frustumCenter);
-	Plane octantPlaneRight = planeFromNormalAndPoint(glm::cross(lookDir, up), frustumCenter);
-	Plane octantPlaneTop = planeFromNormalAndPoint(glm::cross(glm::vec3(octantPlaneRight), lookDir), frustumCenter);
-	float frustCenterPlaneDistMin = std::numeric_limits<float>::max();
-	for(const Plane& p : frustumPlanes)
-		frustCenterPlaneDistMin = fmin(frustCenterPlaneDistMin, glm::dot(p, glm::vec4(frustumCenter, 1)));
+struct BVH::FrustumTestData {
+	FrustumTestData(const Frustum& f):
+		aabbTester{f.planes},
+		exactTester{f.planes}
+	{
+		octantPlaneFront = planeFromNormalAndPoint(f.lookDir, f.center);
+		octantPlaneRight = planeFromNormalAndPoint(glm::cross(f.lookDir, f.up), f.center);
+		octantPlaneTop = planeFromNormalAndPoint(glm::cross(glm::vec3(octantPlaneRight), f.lookDir), f.center);
+		frustCenterPlaneDistMin = std::numeric_limits<float>::max();
+		for(const Plane& p : f.planes)
+			frustCenterPlaneDistMin = fmin(frustCenterPlaneDistMin, glm::dot(p, glm::vec4(f.center, 1)));
+	}
+
+	Plane octantPlaneFront;
+	Plane octantPlaneRight;
+	Plane octantPlaneTop;
+	float frustCenterPlaneDistMin;
+	AAboxInPlanesTester_conservative aabbTester;
+	AAboxInFrustumTester_exact exactTester;
+};
+
+bool BVH::isLeaf(unsigned nodeI) const {
+	return _nodes[nodeI].rightChild == nodeI+1 || _nodes[nodeI].rightChild == unsigned(-1);
+}
+
+ContainmentType BVH::nodeInFrustum(unsigned nodeI, FrustumTestData& t, uint8_t* failPlane, PlaneMask& testedPlanes) const {
+	const BVHNode& node = _nodes[nodeI];
+	ContainmentType c;
+	if(node.boundingSphereRadius < t.frustCenterPlaneDistMin && OCTANT_TEST_ENABLED) { // can do octant test
+		const PlaneMask octantPlanesMask = octantToFrustumPlaneMask(node.centroid, t.octantPlaneTop, t.octantPlaneFront, t.octantPlaneRight);
+		PlaneMask planeMask = octantPlanesMask & testedPlanes; // do not test against planes disabled by plane masking optimization
+		c = t.aabbTester.boxInPlanes(node.bounds, failPlane, &planeMask);
+		// plane masking might have disabled some additional planes - update the mask stored inside the node
+		PlaneMask newlyDisabledPlanes = octantPlanesMask^planeMask;
+		testedPlanes &= ~newlyDisabledPlanes;
+	}
+	else
+		c = t.aabbTester.boxInPlanes(node.bounds, failPlane, &testedPlanes);
+	if(c == ContainmentType::Intersecting && EXACT_CULLING_ENABLED) {
+		++FC_EXACT_TEST_COUNT;
+		if(t.exactTester.boxOutside(node.bounds)) {
+			FC_EXACT_TEST_CULLED_TRIANGLE_COUNT += _nodePrimitives[nodeI].count;
+			c = ContainmentType::Outside;
+		}
+	}
+	return c;
+}
+
+bool BVH::nodeSmallerThan(unsigned nodeI, const Frustum& frustum, float pixelThreshold) const {
+	const BVHNode& node = _nodes[nodeI];
+	float distance = glm::distance(frustum.viewPoint, node.centroid);
+	if(distance <= node.boundingSphereRadius)
+		return false;
+	return 2*node.boundingSphereRadius*frustum.projectionScale < pixelThreshold*distance;
+}
+
+bool BVH::proxyPreciseEnough(unsigned nodeI, const Frustum& frustum) const {
+	const AABB& b = _nodes[nodeI].bounds;
+	float distance = glm::distance(glm::clamp(frustum.viewPoint, b.min, b.max), frustum.viewPoint);
+	return _nodeProxies[nodeI].error*frustum.projectionScale < LOD_PIXEL_ERROR_THRESHOLD*distance;
+}
+
+/** Returns true if all primitives with normals in the cone which lie in the sphere are back facing from the view point.
+ */
+static bool coneBackFacing(const NormalCone& cone, const glm::vec3& centroid, float radius, const glm::vec3& viewPoint) {
+	if(cone.cosAngle <= 0)
+		return false;
+	// each primitive lies in the bounding sphere, so it is back facing if dot(normal, centroid-viewPoint) > radius
+	// the smallest dot product over the normals in the cone is |d|*cos(angle(axis,d) + coneAngle)
+	glm::vec3 d = centroid - viewPoint;
+	float cosAxisD = glm::dot(cone.axis, d);
+	float sinAxisD = glm::length(glm::cross(cone.axis, d));
+	return cosAxisD*cone.cosAngle - sinAxisD*cone.sinAngle > radius;
+}
+
+bool BVH::nodeBackFacing(unsigned nodeI, const glm::vec3& viewPoint) const {
+	const BVHNode& node = _nodes[nodeI];
+	return coneBackFacing(node.normalCone, node.centroid, node.boundingSphereRadius, viewPoint);
+}
+
+void appendPrimitiveRange(std::vector<NodePrimitives>& ranges, const NodePrimitives& range, unsigned maxGap) {
+	if(!ranges.empty() && maxGap != NO_RANGE_MERGING) {
+		NodePrimitives& last = ranges.back();
+		unsigned lastEnd = last.first + last.count;
+		if(range.first >= lastEnd && range.first - lastEnd <= maxGap) {
+			last.count = range.first + range.count - last.first;
+			return;
+		}
+	}
+	ranges.push_back(range);
+}
+
+template <typename EmitNodeF, typename EmitProxyF, typename EmitMeshletF>
+void BVH::traverseFrustum(const Frustum& frustum, EmitNodeF emitNode, EmitProxyF emitProxy, bool useProxies, EmitMeshletF emitMeshlet, bool useMeshlets) {
 	struct NodeInfo {
 		unsigned id;
 		PlaneMask testedPlanes;
 	};
-	static std::vector<unsigned> nodesInFrustum;
-	nodesInFrustum.clear();
 	std::stack<NodeInfo> forward;
-	AAboxInPlanesTester_conservative aabbTester(frustumPlanes);
+	FrustumTestData testData(frustum);
 	auto goForward = [&](NodeInfo& n)->bool {
-		while(!forward.empty() && forward.top().id <= n.id && forward.top().id != unsigned(-1))
-			forward.pop();
 		if(forward.empty())
 			return false;
 		n = forward.top();
@@ -160,31 +496,63 @@ const std::vector<unsigned>& BVH::nodesInFrustum(const std::vector<Plane>& frust
 	NodeInfo n = {0, PLANESMASK_ALL};
 	while(n.id < _nodes.size()) {
 		++FC_NODE_VISITED_COUNT;
-		ContainmentType boxFrustumCont;
-		if(_nodes[n.id].boundingSphereRadius < frustCenterPlaneDistMin && OCTANT_TEST_ENABLED) { // can do octant test
-			const PlaneMask octantPlanesMask = octantToFrustumPlaneMask(_nodes[n.id].centroid, octantPlaneTop, octantPlaneFront, octantPlaneRight);
-			PlaneMask planeMask = octantPlanesMask & n.testedPlanes; // do not test against planes disabled by plane masking optimization
-			boxFrustumCont = aabbTester.boxInPlanes(_nodes[n.id].bounds, &_nodes[n.id].firstFrustumTestPlane, &planeMask);
-			// plane masking might have disabled some additional planes - update the mask stored inside the node
-			PlaneMask newlyDisabledPlanes = octantPlanesMask^planeMask;
-			n.testedPlanes &= ~newlyDisabledPlanes;
+		LeafRestriction restriction = _leafRestriction.empty() ? AllLeaves : _leafRestriction[n.id];
+		if(restriction == NoLeaves) {
+			FC_PVS_CULLED_TRIANGLE_COUNT += _nodePrimitives[n.id].count;
+			if(!goForward(n))
+				break;
+			continue;
 		}
-		else
-			boxFrustumCont = aabbTester.boxInPlanes(_nodes[n.id].bounds, &_nodes[n.id].firstFrustumTestPlane, &n.testedPlanes);
+		ContainmentType boxFrustumCont = nodeInFrustum(n.id, testData, &_nodes[n.id].firstFrustumTestPlane, n.testedPlanes);
+		if(boxFrustumCont != ContainmentType::Outside && SMALL_FEATURE_CULLING_ENABLED && nodeSmallerThan(n.id, frustum, SMALL_FEATURE_PIXEL_THRESHOLD)) {
+			FC_SMALL_FEATURE_CULLED_TRIANGLE_COUNT += _nodePrimitives[n.id].count;
+			boxFrustumCont = ContainmentType::Outside;
+		}
+		if(boxFrustumCont != ContainmentType::Outside && BF_CULLING_ENABLED && NORMAL_CONE_CULLING_ENABLED && nodeBackFacing(n.id, frustum.viewPoint)) {
+			FC_NORMAL_CONE_CULLED_TRIANGLE_COUNT += _nodePrimitives[n.id].count;
+			boxFrustumCont = ContainmentType::Outside;
+		}
+		if(boxFrustumCont != ContainmentType::Outside && useProxies && restriction == AllLeaves
+				&& _nodeProxies[n.id].primitives.count > 0 && proxyPreciseEnough(n.id, frustum)) {
+			++FC_LOD_NODE_COUNT;
+			emitProxy(n.id);
+			if(!goForward(n))
+				break;
+			continue;
+		}
+		if(boxFrustumCont == ContainmentType::Inside && restriction == SomeLeaves)
+			boxFrustumCont = ContainmentType::Intersecting; // the children are still filtered
 		if(boxFrustumCont == ContainmentType::Inside) {
-			nodesInFrustum.push_back(n.id);
+			emitNode(n.id);
 			if(!goForward(n))
 				break;
 		}
 		else if(boxFrustumCont == ContainmentType::Intersecting) {
-			if(_nodes[n.id].rightChild == n.id+1 || _nodes[n.id].rightChild == unsigned(-1)) { // the current node is a leaf
-				nodesInFrustum.push_back(n.id);
+			if(isLeaf(n.id)) {
+				if(useMeshlets && _nodeMeshlets[n.id].count > 0) {
+					// the planes the leaf is inside of are masked out
+					for(unsigned m = _nodeMeshlets[n.id].first; m < _nodeMeshlets[n.id].first + _nodeMeshlets[n.id].count; ++m) {
+						const Meshlet& meshlet = _meshlets[m];
+						PlaneMask testedPlanes = n.testedPlanes;
+						uint8_t failPlane = _nodes[n.id].firstFrustumTestPlane;
+						if(testData.aabbTester.boxInPlanes(meshlet.bounds, &failPlane, &testedPlanes) == ContainmentType::Outside
+								|| (BF_CULLING_ENABLED && NORMAL_CONE_CULLING_ENABLED && coneBackFacing(meshlet.normalCone, meshlet.centroid, meshlet.boundingSphereRadius, frustum.viewPoint)))
+							FC_MESHLET_CULLED_TRIANGLE_COUNT += meshlet.primitives.count;
+						else
+							emitMeshlet(m);
+					}
+				}
+				else
+					emitNode(n.id);
 				if(!goForward(n))
 					break;
 			}
 			else {
-				forward.push({_nodes[n.id].rightChild, n.testedPlanes});
-				++n.id;
+				unsigned nearChild = n.id+1, farChild = _nodes[n.id].rightChild;
+				if(FRONT_TO_BACK_ORDERING_ENABLED && frustum.lookDir[_nodes[n.id].splitAxis] < 0)
+					std::swap(nearChild, farChild);
+				forward.push({farChild, n.testedPlanes});
+				n.id = nearChild;
 			}
 		}
 		else if(boxFrustumCont == ContainmentType::Outside) {
@@ -195,9 +563,214 @@ const std::vector<unsigned>& BVH::nodesInFrustum(const std::vector<Plane>& frust
 			assert(false);
 		}
 	}
+}
+
+const std::vector<unsigned>& BVH::nodesInFrustum(const Frustum& frustum, std::vector<unsigned>* proxyNodes) {
+	static std::vector<unsigned> nodesInFrustum;
+	nodesInFrustum.clear();
+	traverseFrustum(frustum,
+			[&](unsigned nodeI){ nodesInFrustum.push_back(nodeI); },
+			[&](unsigned nodeI){ proxyNodes->push_back(nodeI); },
+			proxyNodes && LOD_ENABLED && !_nodeProxies.empty(),
+			[](unsigned){},
+			false);
 	return nodesInFrustum;
 }
 
+const std::vector<NodePrimitives>& BVH::primitiveRangesInFrustum(const Frustum& frustum, unsigned maxMergeGap, std::vector<NodePrimitives>* proxyRanges) {
+	static std::vector<NodePrimitives> rangesInFrustum;
+	rangesInFrustum.clear();
+	traverseFrustum(frustum,
+			[&](unsigned nodeI){ appendPrimitiveRange(rangesInFrustum, _nodePrimitives[nodeI], maxMergeGap); },
+			[&](unsigned nodeI){ appendPrimitiveRange(*proxyRanges, _nodeProxies[nodeI].primitives, maxMergeGap); },
+			proxyRanges && LOD_ENABLED && !_nodeProxies.empty(),
+			[&](unsigned meshletI){ appendPrimitiveRange(rangesInFrustum, _meshlets[meshletI].primitives, maxMergeGap); },
+			MESHLET_CULLING_ENABLED && !_meshlets.empty());
+	return rangesInFrustum;
+}
+
+void BVH::nodesInFrustums(const std::vector<Frustum>& frustums, std::vector<std::vector<unsigned>>& visibleNodes) {
+	assert(frustums.size() <= MAX_FRUSTUMS_PER_TRAVERSAL);
+	struct NodeInfo {
+		unsigned id;
+		FrustumMask activeFrustums;
+		PlaneMask testedPlanes[MAX_FRUSTUMS_PER_TRAVERSAL];
+	};
+	visibleNodes.resize(frustums.size());
+	for(std::vector<unsigned>& v : visibleNodes)
+		v.clear();
+	std::vector<FrustumTestData> testData(frustums.begin(), frustums.end());
+	std::stack<NodeInfo> nodes;
+	NodeInfo root;
+	root.id = 0;
+	root.activeFrustums = FrustumMask((1u<<frustums.size())-1);
+	std::fill(std::begin(root.testedPlanes), std::end(root.testedPlanes), PLANESMASK_ALL);
+	nodes.push(root);
+	while(!nodes.empty()) {
+		NodeInfo n = nodes.top();
+		nodes.pop();
+		++FC_NODE_VISITED_COUNT;
+		bool leaf = isLeaf(n.id);
+		for(unsigned f = 0; f < frustums.size(); ++f) {
+			if(!(n.activeFrustums & 1<<f))
+				continue;
+			// the plane stored in the node is only a hint for other frustums than the first one, so that they do not overwrite each other
+			uint8_t failPlane = _nodes[n.id].firstFrustumTestPlane;
+			ContainmentType c = nodeInFrustum(n.id, testData[f], &failPlane, n.testedPlanes[f]);
+			if(f == 0)
+				_nodes[n.id].firstFrustumTestPlane = failPlane;
+			if(c == ContainmentType::Inside || (c == ContainmentType::Intersecting && leaf)) {
+				visibleNodes[f].push_back(n.id);
+				n.activeFrustums &= ~(1<<f);
+			}
+			else if(c == ContainmentType::Outside)
+				n.activeFrustums &= ~(1<<f);
+		}
+		if(n.activeFrustums && !leaf) {
+			NodeInfo r = n;
+			r.id = _nodes[n.id].rightChild;
+			nodes.push(r);
+			++n.id;
+			nodes.push(n);
+		}
+	}
+}
+
+unsigned BVH::visibleSubtreeRanges(const std::vector<unsigned>& nodes, const std::function<bool(unsigned nodeI)>& nodeVisible, std::vector<NodePrimitives>& ranges, unsigned maxMergeGap) const {
+	unsigned culledPrimitiveCount = 0;
+	std::stack<unsigned> subtree;
+	for(unsigned root : nodes) {
+		subtree.push(root);
+		while(!subtree.empty()) {
+			unsigned n = subtree.top();
+			subtree.pop();
+			if(!nodeVisible(n))
+				culledPrimitiveCount += _nodePrimitives[n].count;
+			else if(isLeaf(n))
+				appendPrimitiveRange(ranges, _nodePrimitives[n], maxMergeGap);
+			else {
+				subtree.push(_nodes[n].rightChild);
+				subtree.push(n+1);
+			}
+		}
+	}
+	return culledPrimitiveCount;
+}
+
 const std::vector<NodePrimitives>& BVH::getNodePrimitiveRanges() const {
 	return _nodePrimitives;
 }
+
+const AABB& BVH::getNodeBounds(unsigned nodeI) const {
+	return _nodes[nodeI].bounds;
+}
+
+void BVH::restrictToLeaves(const std::vector<unsigned>* leaves) {
+	if(!leaves) {
+		_leafRestriction.clear();
+		return;
+	}
+	_leafRestriction.assign(_nodes.size(), NoLeaves);
+	for(unsigned l : *leaves) {
+		assert(isLeaf(l));
+		_leafRestriction[l] = AllLeaves;
+	}
+	// children always follow their parent
+	for(unsigned n = _nodes.size(); n-- > 0;)
+		if(!isLeaf(n)) {
+			LeafRestriction l = _leafRestriction[n+1];
+			LeafRestriction r = _leafRestriction[_nodes[n].rightChild];
+			if(l == AllLeaves && r == AllLeaves)
+				_leafRestriction[n] = AllLeaves;
+			else if(l != NoLeaves || r != NoLeaves)
+				_leafRestriction[n] = SomeLeaves;
+		}
+}
+
+unsigned BVH::closestHitLeaf(const glm::vec3& origin, const glm::vec3& direction, const std::function<float(unsigned primitive)>& primitiveHitDistance) const {
+	const float inf = std::numeric_limits<float>::infinity();
+	glm::vec3 invDirection = 1.f/direction;
+	// returns the ray parameter at which the ray enters the node box
+	auto boxEntry = [&](unsigned nodeI) {
+		const AABB& b = _nodes[nodeI].bounds;
+		glm::vec3 t0 = (b.min-origin)*invDirection;
+		glm::vec3 t1 = (b.max-origin)*invDirection;
+		glm::vec3 tNear = glm::min(t0, t1);
+		glm::vec3 tFar = glm::max(t0, t1);
+		float tEnter = std::max({tNear.x, tNear.y, tNear.z, 0.f});
+		float tExit = std::min({tFar.x, tFar.y, tFar.z});
+		return tEnter <= tExit ? tEnter : inf;
+	};
+
+	float closest = inf;
+	unsigned closestLeaf = unsigned(-1);
+	std::stack<std::pair<float, unsigned>> nodes;
+	nodes.push({boxEntry(0), 0});
+	while(!nodes.empty()) {
+		float tEnter = nodes.top().first;
+		unsigned n = nodes.top().second;
+		nodes.pop();
+		if(tEnter >= closest)
+			continue;
+		if(isLeaf(n)) {
+			const NodePrimitives& r = _nodePrimitives[n];
+			for(unsigned p = r.first; p < r.first + r.count; ++p) {
+				float t = primitiveHitDistance(p);
+				if(t < closest) {
+					closest = t;
+					closestLeaf = n;
+				}
+			}
+		}
+		else {
+			unsigned nearChild = n+1, farChild = _nodes[n].rightChild;
+			float tNear = boxEntry(nearChild), tFar = boxEntry(farChild);
+			if(tNear > tFar) {
+				std::swap(nearChild, farChild);
+				std::swap(tNear, tFar);
+			}
+			// the nearer child is visited first
+			if(tFar < closest)
+				nodes.push({tFar, farChild});
+			if(tNear < closest)
+				nodes.push({tNear, nearChild});
+		}
+	}
+	return closestLeaf;
+}
+
+std::vector<uint8_t> BVH::getFrustumTestPlanes() const {
+	std::vector<uint8_t> planes(_nodes.size());
+	for(unsigned i = 0; i < _nodes.size(); ++i)
+		planes[i] = _nodes[i].firstFrustumTestPlane;
+	return planes;
+}
+
+void BVH::setFrustumTestPlanes(const std::vector<uint8_t>& planes) {
+	for(unsigned i = 0; i < _nodes.size(); ++i)
+		_nodes[i].firstFrustumTestPlane = planes[i];
+}
+
+unsigned BVH::getNodeCount() const {
+	return _nodes.size();
+}
+
+unsigned BVH::getRightChild(unsigned nodeI) const {
+	return _nodes[nodeI].rightChild;
+}
+
+const std::vector<NodeProxy>& BVH::getNodeProxies() const {
+	return _nodeProxies;
+}
+
+const std::vector<NodeOccluders>& BVH::getNodeOccluders() const {
+	return _nodeOccluders;
+}
+
+const std::vector<unsigned>& BVH::getOccluderPrimitives() const {
+	return _occluderPrimitives;
+}
+
+const std::vector<Meshlet>& BVH::getMeshlets() const {
+	return _meshlets;
+}
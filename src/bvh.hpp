@@ -2,13 +2,25 @@
 #define BVH_HPP_19_04_24_14_47_14 
 #include <vector>
 #include <memory>
+#include <functional>
 #include "types.hpp"
+#include "containment.hpp"
 
 /** Information about a primitive (triangle).
  */
 struct PrimitiveInfo {
 	unsigned indices[3];
 	glm::vec3 centroid;
+	glm::vec3 normal; /// geometric normal of the front (counter-clockwise) face
+	unsigned material = 0; /// index into the materials of the object
+};
+
+/** Cone containing the normals of all primitives of a node.
+ */
+struct NormalCone {
+	glm::vec3 axis;
+	float cosAngle; /// <= 0 if the cone is not narrower than a half space and cannot be used for culling
+	float sinAngle;
 };
 
 /** Range of primitives given by index of the first and count.
@@ -18,10 +30,60 @@ struct NodePrimitives {
 	unsigned count;
 };
 
+/** Large triangles of a subtree, which are used as occluders by software occlusion culling.
+ * The triangles are given by a range in the array of occluder primitives.
+ */
+struct NodeOccluders {
+	unsigned first;
+	unsigned count;
+	float area; /// total area of the occluder triangles
+};
+
+/** Simplified mesh replacing all primitives of a subtree when viewed from far enough.
+ * The primitive range refers to the LOD index buffer.
+ */
+struct NodeProxy {
+	NodePrimitives primitives; /// count == 0 if the node has no proxy
+	float error; /// geometric error of the proxy in model space units
+};
+
+/** Cluster of spatially close primitives of a leaf, culled on its own when the leaf intersects the frustum (see MESHLET_CULLING_ENABLED).
+ */
+struct Meshlet {
+	NodePrimitives primitives;
+	AABB bounds;
+	glm::vec3 centroid;
+	float boundingSphereRadius;
+	NormalCone normalCone;
+};
+
+/** Passed as the maximal merge gap to keep one primitive range per node.
+ */
+static const unsigned NO_RANGE_MERGING = unsigned(-1);
+
+/** Appends the range to the ranges, or extends the last range if the two are at most maxGap primitives apart.
+ * Only a range following the last one is merged, a merged range is drawn in the index order
+ * and would undo the order of the front-to-back traversal.
+ */
+void appendPrimitiveRange(std::vector<NodePrimitives>& ranges, const NodePrimitives& range, unsigned maxGap);
+
+/** Bit i is set if the node may still be visible in the i-th frustum of a multi-frustum traversal.
+ */
+using FrustumMask = uint16_t;
+static const unsigned MAX_FRUSTUMS_PER_TRAVERSAL = sizeof(FrustumMask)*8;
+
 /** BVH used for frustum culling.
  * Bounding volumes are axis-aligned boxes.
  */
 class BVH {
+	/** How many leaves of a subtree are allowed by restrictToLeaves.
+	 */
+	enum LeafRestriction: uint8_t {
+		NoLeaves,
+		SomeLeaves,
+		AllLeaves
+	};
+
 	/** Temporary node used only for construction.
 	 * The tree is afterwards rebuilt (compressed) into array using implicit pointers.
 	 */
@@ -32,6 +94,8 @@ class BVH {
 		unsigned firstPrimitive;
 		unsigned primitiveCount;
 		unsigned compressedNodeI;
+		NormalCone normalCone;
+		uint8_t splitAxis = 0;
 	};
 
 	/** Final node used for traversal.
@@ -41,24 +105,138 @@ class BVH {
 		uint32_t rightChild;
 		// data for plane coherency optimization
 		uint8_t firstFrustumTestPlane;
+		// the left child contains the primitives with lower centroid coordinate along this axis
+		uint8_t splitAxis;
 		// data for octant test optimization
 		glm::vec3 centroid;
 		float boundingSphereRadius;
+		// data for normal cone back face culling
+		NormalCone normalCone;
 	};
 
 	public:
 	std::vector<unsigned> build(const std::vector<Vertex>& vertices, const std::vector<PrimitiveInfo>& primitivesInfo, unsigned maxPrimitivesInLeaf);
 
+	/** Creates proxies of the inner nodes by simplifying the proxies (or primitives) of their children to proxyTriangleCount triangles.
+	 * The primitives must be in the order returned by build.
+	 * The proxy meshes are appended to the LOD vertices and indices (in the order of nodes).
+	 */
+	void buildProxies(
+			const std::vector<Vertex>& vertices,
+			const std::vector<PrimitiveInfo>& primitivesInfo,
+			const std::vector<unsigned>& primitives,
+			unsigned proxyTriangleCount,
+			std::vector<Vertex>& lodVertices,
+			std::vector<unsigned>& lodIndices);
+
 	/** Returns a reference to nodes, which contain potentially visible primitives.
+	 * If proxyNodes is given and LOD_ENABLED, the traversal stops at nodes whose proxy projects with error
+	 * smaller than LOD_PIXEL_ERROR_THRESHOLD and these nodes are appended to proxyNodes instead.
 	 * The referenced vector will be reused in next call.
 	 */
-	const std::vector<unsigned>& nodesInFrustum(const std::vector<Plane>& frustumPlanes, const glm::vec3& frustumCenter, const glm::vec3& lookDir, const glm::vec3& up);
+	const std::vector<unsigned>& nodesInFrustum(const Frustum& frustum, std::vector<unsigned>* proxyNodes = nullptr);
+
+	/** Returns a reference to ranges of potentially visible primitives.
+	 * Ranges of visible nodes are merged during the traversal if there are at most maxMergeGap primitives between them,
+	 * trading extra primitives for fewer draw calls.
+	 * Proxies are selected as in nodesInFrustum and their ranges (in the LOD index buffer) are appended to proxyRanges.
+	 * The referenced vector will be reused in next call.
+	 */
+	const std::vector<NodePrimitives>& primitiveRangesInFrustum(const Frustum& frustum, unsigned maxMergeGap, std::vector<NodePrimitives>* proxyRanges = nullptr);
+
+	/** Culls the BVH against several frustums in a single traversal.
+	 * Each node keeps a mask of the frustums it may still be visible in and the subtree is skipped
+	 * as soon as the mask becomes empty.
+	 * visibleNodes[i] receives the nodes which contain potentially visible primitives for frustums[i].
+	 * At most MAX_FRUSTUMS_PER_TRAVERSAL frustums are supported.
+	 */
+	void nodesInFrustums(const std::vector<Frustum>& frustums, std::vector<std::vector<unsigned>>& visibleNodes);
+
+	/** Tests the subtrees of the given nodes by an additional visibility test (e.g. occlusion test) and appends
+	 * the primitive ranges of the visible leaves to the ranges.
+	 * Subtrees are skipped as soon as their root is not visible.
+	 * Returns the number of primitives which were culled.
+	 */
+	unsigned visibleSubtreeRanges(const std::vector<unsigned>& nodes, const std::function<bool(unsigned nodeI)>& nodeVisible, std::vector<NodePrimitives>& ranges, unsigned maxMergeGap) const;
+
+	/** Restricts the frustum traversal to the given leaves (e.g. a potentially visible set), other subtrees are skipped.
+	 * nullptr removes the restriction.
+	 */
+	void restrictToLeaves(const std::vector<unsigned>* leaves);
+
+	/** Returns the plane coherency state (the plane which culled each node last time),
+	 * so that it can be restored after traversals which should not affect the next frame.
+	 */
+	std::vector<uint8_t> getFrustumTestPlanes() const;
+	void setFrustumTestPlanes(const std::vector<uint8_t>& planes);
+
+	/** Returns the leaf containing the primitive closest to the ray origin or unsigned(-1) if no primitive is hit.
+	 * primitiveHitDistance returns the ray parameter of the intersection with the primitive
+	 * (its position in the primitive order returned by build) or infinity.
+	 */
+	unsigned closestHitLeaf(const glm::vec3& origin, const glm::vec3& direction, const std::function<float(unsigned primitive)>& primitiveHitDistance) const;
 
 	/** Returns array of primitive ranges for each node.
 	 */
 	const std::vector<NodePrimitives>& getNodePrimitiveRanges() const;
 
+	const AABB& getNodeBounds(unsigned nodeI) const;
+
+	unsigned getNodeCount() const;
+
+	bool isLeaf(unsigned nodeI) const;
+
+	/** The left child of an inner node is always the next node (nodeI+1).
+	 */
+	unsigned getRightChild(unsigned nodeI) const;
+
+	/** Returns array of proxies for each node, it is empty if the proxies were not built.
+	 */
+	const std::vector<NodeProxy>& getNodeProxies() const;
+
+	/** Returns array of occluders for each node.
+	 */
+	const std::vector<NodeOccluders>& getNodeOccluders() const;
+
+	/** Returns the primitives (their positions in the primitive order returned by build) referenced by NodeOccluders.
+	 */
+	const std::vector<unsigned>& getOccluderPrimitives() const;
+
+	/** Returns the meshlets of all leaves in the primitive order, it is empty if the leaves were not split.
+	 */
+	const std::vector<Meshlet>& getMeshlets() const;
+
 	private:
+		/** Per-frustum data shared by all node tests during one traversal.
+		 */
+		struct FrustumTestData;
+
+		/** Tests the node against the frustum, using the octant test if possible.
+		 * Planes disabled by plane masking are removed from testedPlanes.
+		 */
+		ContainmentType nodeInFrustum(unsigned nodeI, FrustumTestData& t, uint8_t* failPlane, PlaneMask& testedPlanes) const;
+
+		/** Returns true if the projected diameter of the node bounding sphere is smaller than pixelThreshold.
+		 */
+		bool nodeSmallerThan(unsigned nodeI, const Frustum& frustum, float pixelThreshold) const;
+
+		/** Returns true if all primitives of the node are back facing when viewed from the view point.
+		 */
+		bool nodeBackFacing(unsigned nodeI, const glm::vec3& viewPoint) const;
+
+		/** Returns true if the proxy of the node projects with error smaller than LOD_PIXEL_ERROR_THRESHOLD.
+		 */
+		bool proxyPreciseEnough(unsigned nodeI, const Frustum& frustum) const;
+
+		/** Traverses the BVH and calls emitNode(nodeI) for each node which contains potentially visible primitives.
+		 * If FRONT_TO_BACK_ORDERING_ENABLED, the child nearer to the view point along the split axis (by the sign of the look direction) is visited first.
+		 * If useProxies is set, emitProxy(nodeI) is called for nodes which are drawn using their proxy and their subtrees are skipped.
+		 * If useMeshlets is set, the meshlets of the leaves intersecting the frustum are tested and emitMeshlet(meshletI) is called
+		 * for the potentially visible ones instead of emitNode.
+		 */
+		template <typename EmitNodeF, typename EmitProxyF, typename EmitMeshletF>
+		void traverseFrustum(const Frustum& frustum, EmitNodeF emitNode, EmitProxyF emitProxy, bool useProxies, EmitMeshletF emitMeshlet, bool useMeshlets);
+
 		/** Transforms a dynamic BVH with pointers into compressed array form with implicit pointers to be used for traversal.
 		 */
 		void compress(BVHBuildNode&& root);
@@ -73,8 +251,47 @@ class BVH {
 				AABB& primitivesAABBout,
 				AABB& centroidsAABBout);
 
+		/** Selects the largest non-sliver primitives of each subtree as its occluders.
+		 * The primitives must already be in the final order.
+		 */
+		void selectOccluders(const std::vector<Vertex>& vertices, const std::vector<PrimitiveInfo>& primitivesInfo, const std::vector<unsigned>& primitives);
+
+		/** Splits the leaves with more than meshletTriangleCount primitives into meshlets of at most that many primitives
+		 * by halving their primitives at the median centroid along the longest axis of the centroid bounds.
+		 * The primitives are reordered inside the leaves so that each meshlet is a contiguous range.
+		 */
+		void buildMeshlets(const std::vector<Vertex>& vertices, const std::vector<PrimitiveInfo>& primitivesInfo, std::vector<unsigned>& primitives, unsigned meshletTriangleCount);
+
+		/** Returns the primitive ranges of the leaves, or of their meshlets if the leaves are split.
+		 */
+		std::vector<NodePrimitives> leafClusters() const;
+
+		/** Sorts the primitives inside each leaf (or each meshlet if the leaves are split) by their material,
+		 * so that each material of a leaf is a contiguous range. The order of the primitives with the same material is kept.
+		 */
+		void groupLeafMaterials(const std::vector<PrimitiveInfo>& primitivesInfo, std::vector<unsigned>& primitives) const;
+
+		/** Reorders the primitives inside each leaf (or each meshlet if the leaves are split) for the post-transform vertex cache,
+		 * the leaves are processed in parallel. The primitive ranges of the nodes and meshlets do not change
+		 * and the primitives stay grouped by material.
+		 */
+		void optimizeLeafVertexCache(const std::vector<PrimitiveInfo>& primitivesInfo, std::vector<unsigned>& primitives) const;
+
+		/** Calculates the cone bounding the normals of the primitives.
+		 */
+		NormalCone primitivesNormalCone(
+				const std::vector<PrimitiveInfo>& primitivesInfo,
+				std::vector<unsigned>::iterator primitiveIndexBegin,
+				std::vector<unsigned>::iterator primitiveIndexEnd);
+
 		std::vector<BVHNode> _nodes;
 		std::vector<NodePrimitives> _nodePrimitives;
+		std::vector<NodeOccluders> _nodeOccluders;
+		std::vector<NodeProxy> _nodeProxies;
+		std::vector<unsigned> _occluderPrimitives;
+		std::vector<LeafRestriction> _leafRestriction; /// empty if the traversal is not restricted
+		std::vector<Meshlet> _meshlets;
+		std::vector<NodePrimitives> _nodeMeshlets; /// range of _meshlets of each node, count == 0 if the node is not a split leaf
 };
 
 #endif /* BVH_HPP_19_04_24_14_47_14 */
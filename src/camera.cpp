@@ -38,6 +38,14 @@ glm::mat4 Camera::getViewProjection() const {
 	return _proj*_view;
 }
 
+glm::mat4 Camera::getProjection() const {
+	return _proj;
+}
+
+glm::dmat4 Camera::getProjectionD() const {
+	return glm::perspective(double(_fov), 1.0, double(CAM_NEAR), double(CAM_FAR));
+}
+
 glm::vec3 Camera::getPosition() const {
 	return _position;
 }
@@ -72,3 +80,7 @@ void Camera::setFOV(float fov) {
 	_proj = glm::perspective(_fov, 1.0f, CAM_NEAR, CAM_FAR);
 	updateView();
 }
+
+float Camera::getFOV() const {
+	return _fov;
+}
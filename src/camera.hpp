@@ -18,6 +18,11 @@ class Camera {
 		void rotateHoriz(float delta);
 
 		glm::mat4 getViewProjection() const;
+		glm::mat4 getProjection() const;
+
+		/** Returns the projection matrix computed in double precision.
+		 */
+		glm::dmat4 getProjectionD() const;
 		glm::vec3 getPosition() const;
 		glm::vec3 getLookDir() const;
 		float getNear() const;
@@ -28,6 +33,7 @@ class Camera {
 		/** Sets the horizontal and vertical field of view in radians.
 		 */
 		void setFOV(float fov);
+		float getFOV() const;
 
 	private:
 		void updateView();
@@ -0,0 +1,261 @@
+#include <iostream>
+#include <queue>
+#include <deque>
+#include <cstdlib>
+#include <glm/gtc/type_ptr.hpp>
+#include "chc.hpp"
+#include "utils.hpp"
+#include "globals.hpp"
+
+static const unsigned MAX_MULTIQUERY_NODES = 8; // nodes invisible in the last frame tested by a single query
+static const unsigned VISIBLE_QUERY_BATCH_SIZE = 16;
+static const unsigned VISIBLE_LEAF_QUERY_INTERVAL = 5; // [frames] (+ random offset up to the same value)
+
+namespace {
+	/** Shared by all cullers, it lives as long as the GL context.
+	 */
+	struct BoxRenderer {
+		GLuint program;
+		GLuint vao;
+		GLuint vertexBuffer;
+		GLint modelViewProjectLoc;
+		GLint boxMinLoc;
+		GLint boxSizeLoc;
+	};
+
+	const BoxRenderer& boxRenderer() {
+		static BoxRenderer br = [](){
+			BoxRenderer br;
+			br.program = loadShaderProgram({
+					{ GL_VERTEX_SHADER, "../data/shaders/bbox.vert" },
+					{ GL_FRAGMENT_SHADER, "../data/shaders/bbox.frag" },
+					});
+			if(!br.program)
+				std::cerr << "Failed to load bounding box shader program\n";
+			br.modelViewProjectLoc = glGetUniformLocation(br.program, "ModelViewProject");
+			br.boxMinLoc = glGetUniformLocation(br.program, "BoxMin");
+			br.boxSizeLoc = glGetUniformLocation(br.program, "BoxSize");
+
+			// unit cube, two triangles per face
+			AABB unitBox;
+			unitBox.unite(glm::vec3(0)).unite(glm::vec3(1));
+			std::vector<glm::vec3> vertices;
+			for(unsigned axisBit = 0; axisBit < 3; ++axisBit)
+				for(unsigned side = 0; side < 2; ++side) {
+					unsigned u = 1<<((axisBit+1)%3), v = 1<<((axisBit+2)%3);
+					unsigned base = side<<axisBit;
+					unsigned quad[4] = {base, base|u, base|u|v, base|v};
+					for(unsigned i : {0, 1, 2, 0, 2, 3})
+						vertices.push_back(unitBox[AABB::VertexIndex(quad[i])]);
+				}
+			glGenVertexArrays(1, &br.vao);
+			glBindVertexArray(br.vao);
+			glGenBuffers(1, &br.vertexBuffer);
+			glBindBuffer(GL_ARRAY_BUFFER, br.vertexBuffer);
+			glBufferData(GL_ARRAY_BUFFER, vertices.size()*sizeof(glm::vec3), vertices.data(), GL_STATIC_DRAW);
+			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), 0);
+			glEnableVertexAttribArray(0);
+			return br;
+		}();
+		return br;
+	}
+}
+
+CHCOcclusionCuller::CHCOcclusionCuller():
+	_frame{0},
+	_renderedTriangleCount{0}
+{}
+
+CHCOcclusionCuller::~CHCOcclusionCuller() {
+	if(!_freeQueries.empty())
+		glDeleteQueries(_freeQueries.size(), _freeQueries.data());
+}
+
+unsigned CHCOcclusionCuller::render(const BVH& bvh, const Frustum& frustum, const IndexBufferLayout& indexLayout) {
+	++_frame;
+	_renderedTriangleCount = 0;
+	if(_nodeStates.size() != bvh.getNodeCount()) {
+		_nodeStates.assign(bvh.getNodeCount(), NodeState{});
+		_parents.assign(bvh.getNodeCount(), unsigned(-1));
+		for(unsigned n = 0; n < bvh.getNodeCount(); ++n)
+			if(!bvh.isLeaf(n)) {
+				_parents[n+1] = n;
+				_parents[bvh.getRightChild(n)] = n;
+			}
+	}
+
+	AAboxInPlanesTester_conservative frustumTester(frustum.planes);
+	// boxes this close to the viewpoint may be clipped by the near plane and cannot be queried
+	float nearDistance = -glm::dot(frustum.planes[Near], glm::vec4(frustum.viewPoint, 1));
+	float unqueryableDistance = 2*nearDistance;
+
+	using DistanceNode = std::pair<float, unsigned>;
+	std::priority_queue<DistanceNode, std::vector<DistanceNode>, std::greater<DistanceNode>> distanceQueue;
+	auto pushNode = [&](unsigned nodeI) {
+		const AABB& b = bvh.getNodeBounds(nodeI);
+		distanceQueue.push({glm::distance(glm::clamp(frustum.viewPoint, b.min, b.max), frustum.viewPoint), nodeI});
+	};
+	std::deque<Query> queryQueue;
+	std::vector<Query> pendingQueries;
+	std::vector<unsigned> invisibleNodes; // I-queue: waiting to be batched into a multiquery
+	std::vector<unsigned> visibleLeaves;  // V-queue: already drawn, waiting to be verified
+
+	auto flushInvisibleNodes = [&]() {
+		if(invisibleNodes.empty())
+			return;
+		pendingQueries.push_back({getQuery(), invisibleNodes, false});
+		invisibleNodes.clear();
+	};
+	auto flushVisibleLeaves = [&]() {
+		for(unsigned n : visibleLeaves)
+			pendingQueries.push_back({getQuery(), {n}, true});
+		visibleLeaves.clear();
+	};
+	auto issuePending = [&]() {
+		if(pendingQueries.empty())
+			return;
+		issueQueries(bvh, pendingQueries, frustum);
+		for(Query& q : pendingQueries)
+			queryQueue.push_back(std::move(q));
+		pendingQueries.clear();
+	};
+
+	pushNode(0);
+	while(!distanceQueue.empty() || !queryQueue.empty()) {
+		// handle the finished queries, wait for the result only if there is nothing to traverse
+		while(!queryQueue.empty()) {
+			Query& q = queryQueue.front();
+			GLuint available = GL_FALSE;
+			glGetQueryObjectuiv(q.id, GL_QUERY_RESULT_AVAILABLE, &available);
+			if(!available) {
+				if(!distanceQueue.empty())
+					break;
+				++FC_OCCLUSION_QUERY_WAIT_COUNT; // stall
+			}
+			GLuint anySamplesPassed = GL_FALSE;
+			glGetQueryObjectuiv(q.id, GL_QUERY_RESULT, &anySamplesPassed);
+			_freeQueries.push_back(q.id);
+			if(anySamplesPassed) {
+				if(q.nodes.size() > 1) // the multiquery failed, the nodes are queried one by one
+					for(unsigned n : q.nodes)
+						pendingQueries.push_back({getQuery(), {n}, false});
+				else {
+					unsigned n = q.nodes[0];
+					pullUpVisibility(n);
+					_nodeStates[n].nextQueryFrame = _frame + VISIBLE_LEAF_QUERY_INTERVAL + std::rand()%VISIBLE_LEAF_QUERY_INTERVAL;
+					if(!q.nodesRendered)
+						traverseNode(bvh, indexLayout, n, pushNode);
+				}
+			}
+			else if(!q.nodesRendered)
+				for(unsigned n : q.nodes)
+					FC_OCCLUSION_CULLED_TRIANGLE_COUNT += bvh.getNodePrimitiveRanges()[n].count;
+			queryQueue.pop_front();
+			issuePending();
+		}
+
+		if(!distanceQueue.empty()) {
+			unsigned n = distanceQueue.top().second;
+			distanceQueue.pop();
+			++FC_NODE_VISITED_COUNT;
+			const AABB& box = bvh.getNodeBounds(n);
+			if(frustumTester.boxInPlanes(box) != Outside) {
+				NodeState& s = _nodeStates[n];
+				bool wasVisible = s.visible && s.lastVisitedFrame == _frame-1;
+				s.visible = false;
+				s.lastVisitedFrame = _frame;
+				if(glm::distance(glm::clamp(frustum.viewPoint, box.min, box.max), frustum.viewPoint) <= unqueryableDistance) {
+					pullUpVisibility(n);
+					traverseNode(bvh, indexLayout, n, pushNode);
+				}
+				else if(!wasVisible) {
+					invisibleNodes.push_back(n);
+					if(invisibleNodes.size() >= MAX_MULTIQUERY_NODES)
+						flushInvisibleNodes();
+				}
+				else {
+					if(bvh.isLeaf(n)) {
+						if(_frame >= s.nextQueryFrame)
+							visibleLeaves.push_back(n);
+						else
+							pullUpVisibility(n);
+					}
+					// visibility of inner nodes is pulled up from their children
+					traverseNode(bvh, indexLayout, n, pushNode);
+				}
+				if(visibleLeaves.size() >= VISIBLE_QUERY_BATCH_SIZE)
+					flushVisibleLeaves();
+			}
+		}
+		if(distanceQueue.empty()) {
+			flushInvisibleNodes();
+			flushVisibleLeaves();
+		}
+		issuePending();
+	}
+	return _renderedTriangleCount;
+}
+
+void CHCOcclusionCuller::issueQueries(const BVH& bvh, const std::vector<Query>& queries, const Frustum& frustum) {
+	const BoxRenderer& br = boxRenderer();
+	GLint program, vao;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &vao);
+	GLboolean cullFace = glIsEnabled(GL_CULL_FACE);
+
+	glUseProgram(br.program);
+	glBindVertexArray(br.vao);
+	glUniformMatrix4fv(br.modelViewProjectLoc, 1, GL_FALSE, glm::value_ptr(frustum.modelViewProjection));
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glDepthMask(GL_FALSE);
+	glDisable(GL_CULL_FACE);
+	for(const Query& q : queries) {
+		glBeginQuery(GL_ANY_SAMPLES_PASSED, q.id);
+		for(unsigned n : q.nodes) {
+			const AABB& b = bvh.getNodeBounds(n);
+			glUniform3fv(br.boxMinLoc, 1, glm::value_ptr(b.min));
+			glUniform3fv(br.boxSizeLoc, 1, glm::value_ptr(b.max-b.min));
+			glDrawArrays(GL_TRIANGLES, 0, 36);
+		}
+		glEndQuery(GL_ANY_SAMPLES_PASSED);
+	}
+	FC_OCCLUSION_QUERY_COUNT += queries.size();
+
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	glDepthMask(GL_TRUE);
+	if(cullFace)
+		glEnable(GL_CULL_FACE);
+	glUseProgram(program);
+	glBindVertexArray(vao);
+}
+
+template<typename PushF>
+void CHCOcclusionCuller::traverseNode(const BVH& bvh, const IndexBufferLayout& indexLayout, unsigned nodeI, PushF pushNode) {
+	if(bvh.isLeaf(nodeI)) {
+		const NodePrimitives& r = bvh.getNodePrimitiveRanges()[nodeI];
+		FC_DRAW_CALL_COUNT += indexLayout.drawRange(r);
+		_renderedTriangleCount += r.count;
+	}
+	else {
+		pushNode(nodeI+1);
+		pushNode(bvh.getRightChild(nodeI));
+	}
+}
+
+void CHCOcclusionCuller::pullUpVisibility(unsigned nodeI) {
+	while(nodeI != unsigned(-1) && !_nodeStates[nodeI].visible) {
+		_nodeStates[nodeI].visible = true;
+		nodeI = _parents[nodeI];
+	}
+}
+
+GLuint CHCOcclusionCuller::getQuery() {
+	GLuint q;
+	if(_freeQueries.empty())
+		glGenQueries(1, &q);
+	else {
+		q = _freeQueries.back();
+		_freeQueries.pop_back();
+	}
+	return q;
+}
@@ -0,0 +1,66 @@
+/** @file */
+#ifndef CHC_HPP_26_10_19_15_31_08
+#define CHC_HPP_26_10_19_15_31_08
+#include <vector>
+#include "bvh.hpp"
+#include "indexBufferLayout.hpp"
+
+/** GPU occlusion culling of BVH nodes using hardware occlusion queries (GL_ANY_SAMPLES_PASSED) on the node bounding boxes.
+ * It follows Coherent Hierarchical Culling Revisited (CHC++, Mattausch et al. 2008):
+ * - the nodes are traversed front-to-back and the visibility from the last frame is reused
+ * - leaves visible in the last frame are drawn right away and their visibility is only verified every few frames
+ * - the traversal waits for a query result only if there is nothing else to do
+ * - nodes invisible in the last frame are queried in batches (multiqueries), which are split when they turn out to be visible
+ * - the query state changes are batched as well
+ */
+class CHCOcclusionCuller {
+	public:
+		CHCOcclusionCuller();
+		~CHCOcclusionCuller();
+
+		CHCOcclusionCuller(const CHCOcclusionCuller&) = delete;
+		CHCOcclusionCuller& operator=(const CHCOcclusionCuller&) = delete;
+
+		CHCOcclusionCuller(CHCOcclusionCuller&&) = default;
+		CHCOcclusionCuller& operator=(CHCOcclusionCuller&&) = default;
+
+		/** Draws the visible leaves of the BVH as GL_TRIANGLES using the currently bound VAO and program.
+		 * The bound index buffer must be in the BVH primitive order and have the given layout.
+		 * The frustum is in model space.
+		 * Returns the number of rendered triangles.
+		 */
+		unsigned render(const BVH& bvh, const Frustum& frustum, const IndexBufferLayout& indexLayout);
+
+	private:
+		struct NodeState {
+			unsigned lastVisitedFrame = 0;
+			unsigned nextQueryFrame = 0; /// visible leaves are not queried before this frame
+			bool visible = false;
+		};
+
+		struct Query {
+			GLuint id;
+			std::vector<unsigned> nodes;
+			bool nodesRendered; /// the nodes were visible in the last frame and have already been drawn
+		};
+
+		/** Issues the queries in a single batch, the boxes are drawn with depth and color writes disabled.
+		 */
+		void issueQueries(const BVH& bvh, const std::vector<Query>& queries, const Frustum& frustum);
+
+		/** Draws the leaf or schedules the children for traversal.
+		 */
+		template<typename PushF>
+		void traverseNode(const BVH& bvh, const IndexBufferLayout& indexLayout, unsigned nodeI, PushF pushNode);
+
+		void pullUpVisibility(unsigned nodeI);
+
+		GLuint getQuery();
+
+		unsigned _frame;
+		unsigned _renderedTriangleCount;
+		std::vector<NodeState> _nodeStates;
+		std::vector<unsigned> _parents;
+		std::vector<GLuint> _freeQueries; /// all queries are returned here at the end of the frame
+};
+#endif /* CHC_HPP_26_10_19_15_31_08 */
@@ -1,4 +1,6 @@
 #include <functional>
+#include <algorithm>
+#include <cmath>
 #include "containment.hpp"
 #include "globals.hpp"
 
@@ -132,3 +134,80 @@ AABB::VertexIndex AAboxInPlanesTester_conservative::_pIndex[] = {
 	AABB::VertexIndex::XYz, // + + -  = 6
 	AABB::VertexIndex::XYZ, // + + +  = 7
 };
+
+
+glm::vec3 planesIntersection(const Plane& p1, const Plane& p2, const Plane& p3) {
+	// computed in double - the far plane can be very distant
+	glm::dvec3 n1 = glm::dvec3(glm::vec3(p1));
+	glm::dvec3 n2 = glm::dvec3(glm::vec3(p2));
+	glm::dvec3 n3 = glm::dvec3(glm::vec3(p3));
+	glm::dvec3 p = -double(p1.w)*glm::cross(n2, n3) - double(p2.w)*glm::cross(n3, n1) - double(p3.w)*glm::cross(n1, n2);
+	return glm::vec3(p/glm::dot(n1, glm::cross(n2, n3)));
+}
+
+bool frustumInPlanes(const std::vector<Plane>& frustumPlanes, const std::vector<Plane>& planes) {
+	assert(frustumPlanes.size() == 6);
+	for(unsigned i = 0; i < 8; ++i) {
+		glm::vec3 corner = planesIntersection(
+				frustumPlanes[(i & 4) ? FrustumPlane::Far : FrustumPlane::Near],
+				frustumPlanes[(i & 2) ? FrustumPlane::Top : FrustumPlane::Bot],
+				frustumPlanes[(i & 1) ? FrustumPlane::Right : FrustumPlane::Left]);
+		for(const Plane& p : planes)
+			if(glm::dot(glm::vec3(p), corner) + p.w < 0)
+				return false;
+	}
+	return true;
+}
+
+AAboxInFrustumTester_exact::AAboxInFrustumTester_exact(const std::vector<Plane>& planes) {
+	assert(planes.size() == 6);
+	// corner index bits: near/far, bot/top, left/right
+	for(unsigned i = 0; i < 8; ++i)
+		_corners[i] = planesIntersection(
+				planes[(i & 4) ? FrustumPlane::Far : FrustumPlane::Near],
+				planes[(i & 2) ? FrustumPlane::Top : FrustumPlane::Bot],
+				planes[(i & 1) ? FrustumPlane::Right : FrustumPlane::Left]);
+	glm::vec3 frustumEdges[] = {
+		_corners[4]-_corners[0],
+		_corners[5]-_corners[1],
+		_corners[6]-_corners[2],
+		_corners[7]-_corners[3],
+		_corners[1]-_corners[0],
+		_corners[2]-_corners[0],
+	};
+	for(unsigned boxAxis = 0; boxAxis < 3; ++boxAxis) {
+		glm::vec3 boxEdge(0);
+		boxEdge[boxAxis] = 1;
+		_axes.push_back(boxEdge);
+		for(const glm::vec3& e : frustumEdges) {
+			glm::vec3 axis = glm::cross(boxEdge, e);
+			if(glm::dot(axis, axis) > 1e-12f*glm::dot(e, e))
+				_axes.push_back(axis);
+		}
+	}
+}
+
+bool AAboxInFrustumTester_exact::boxOutside(const AABB& box) const {
+	glm::vec3 boxCenter = box.centroid();
+	glm::vec3 boxHalfExtents = (box.max-box.min)/2.f;
+	for(const glm::vec3& axis : _axes) {
+		float fMin, fMax;
+		projectFrustum(axis, fMin, fMax);
+		float c = glm::dot(axis, boxCenter);
+		float r = glm::dot(glm::abs(axis), boxHalfExtents);
+		// small tolerance so that float imprecision of the (possibly huge) far corners never culls a visible box
+		float eps = 1e-5f*(std::abs(fMin) + std::abs(fMax));
+		if(c + r < fMin - eps || c - r > fMax + eps)
+			return true;
+	}
+	return false;
+}
+
+void AAboxInFrustumTester_exact::projectFrustum(const glm::vec3& axis, float& min, float& max) const {
+	min = max = glm::dot(axis, _corners[0]);
+	for(unsigned i = 1; i < 8; ++i) {
+		float d = glm::dot(axis, _corners[i]);
+		min = std::min(min, d);
+		max = std::max(max, d);
+	}
+}
@@ -76,4 +76,39 @@ class AAboxInPlanesTester_conservative: public AAboxInPlanesTesterBase
 		std::vector<NP> _np; // N and P - indices of AABB vertices for each plane
 };
 
+/** Exact test for AAboxes which were classified as intersecting by a plane test.
+ * The plane tests cannot detect boxes near the frustum edges and corners which lie outside the frustum
+ * while intersecting the half spaces of all its planes.
+ * This tester uses separating axis theorem with the remaining candidate axes - box face normals and
+ * cross products of box edges with frustum edges.
+ */
+class AAboxInFrustumTester_exact {
+	public:
+		/** The planes must be ordered as FrustumPlane and their normals must point inside.
+		 */
+		AAboxInFrustumTester_exact(const std::vector<Plane>& planes);
+
+		/** Returns true if a separating axis between the box and the frustum was found.
+		 * The frustum planes themselves are not tested.
+		 */
+		bool boxOutside(const AABB& box) const;
+
+	private:
+		/** Projects the frustum corners on the axis
+		 */
+		void projectFrustum(const glm::vec3& axis, float& min, float& max) const;
+
+		glm::vec3 _corners[8];
+		std::vector<glm::vec3> _axes;
+};
+
+/** Returns the intersection point of three planes.
+ */
+glm::vec3 planesIntersection(const Plane& p1, const Plane& p2, const Plane& p3);
+
+/** Returns true if all eight corners of the frustum lie inside all the planes, i.e. the frustum is contained in their intersection.
+ * The frustum planes must be ordered as FrustumPlane.
+ */
+bool frustumInPlanes(const std::vector<Plane>& frustumPlanes, const std::vector<Plane>& planes);
+
 #endif /* CONTAINMENT_HPP_19_05_08_11_50_21 */
@@ -1,3 +1,6 @@
+#include <utility>
+#include "globals.hpp"
+
 unsigned MAX_PRIMITIVES_IN_LEAF = 10000;
 
 bool BF_CULLING_ENABLED       = false;
@@ -6,8 +9,89 @@ bool OCTANT_TEST_ENABLED      = true;
 bool PLANE_MASKING_ENABLED    = true;
 bool PLANE_COHERENCY_ENABLED  = true;
 bool CAMERA_COHERENCY_ENABLED = false;
+bool VISIBLE_SET_CACHE_ENABLED = false;
+bool GUARD_BAND_CACHING_ENABLED = false;
+bool EXACT_CULLING_ENABLED    = false;
+bool DRAW_RANGE_COALESCING_ENABLED = true;
+bool FRONT_TO_BACK_ORDERING_ENABLED = false;
+bool CAMERA_RELATIVE_CULLING_ENABLED = false;
+bool SMALL_FEATURE_CULLING_ENABLED = false;
+bool NORMAL_CONE_CULLING_ENABLED = true;
+bool OCCLUSION_CULLING_ENABLED = false;
+bool GPU_OCCLUSION_CULLING_ENABLED = false;
+bool GPU_FRUSTUM_CULLING_ENABLED = false;
+bool GPU_CULLING_VALIDATION_ENABLED = false;
+bool SPECULATIVE_CULLING_ENABLED = false;
+bool PVS_ENABLED = false;
+bool LOD_ENABLED = false;
+bool VERTEX_CACHE_OPTIMIZATION_ENABLED = false;
+bool VERTEX_COMPRESSION_ENABLED = false;
+unsigned MESHLET_TRIANGLE_COUNT = 0;
+bool MESHLET_CULLING_ENABLED = false;
+bool TRIANGLE_CULLING_ENABLED = false;
+unsigned TRIANGLE_CULLING_MIN_LEAF_SIZE = 256;
+bool LEAF_VERTEX_RANGES_ENABLED = false;
+unsigned OCCLUDER_TRIANGLE_BUDGET = 2000;
+float SMALL_FEATURE_PIXEL_THRESHOLD = 1;
+float LOD_PIXEL_ERROR_THRESHOLD = 1;
+float GUARD_BAND_ANGLE = 0.05f;
+float GUARD_BAND_MARGIN = 20;
+unsigned DRAW_RANGE_MERGE_GAP = 0;
+
+bool MULTI_DRAW_INDIRECT_ENABLED = false;
+
+unsigned MULTI_VIEW_COUNT = 1;
 
 unsigned FC_TREE_DEPTH = 0;
 unsigned FC_NODE_COUNT = 0;
-unsigned FC_NODE_VISITED_COUNT = 0;
-float FC_TRAVERSE_TIME = 0;
+thread_local unsigned FC_NODE_VISITED_COUNT = 0;
+thread_local float FC_TRAVERSE_TIME = 0;
+thread_local unsigned FC_DRAW_CALL_COUNT = 0;
+thread_local unsigned FC_SMALL_FEATURE_CULLED_TRIANGLE_COUNT = 0;
+thread_local unsigned FC_NORMAL_CONE_CULLED_TRIANGLE_COUNT = 0;
+thread_local unsigned FC_OCCLUDER_TRIANGLE_COUNT = 0;
+thread_local unsigned FC_OCCLUSION_CULLED_TRIANGLE_COUNT = 0;
+thread_local float FC_OCCLUSION_TIME = 0;
+thread_local unsigned FC_OCCLUSION_QUERY_COUNT = 0;
+thread_local unsigned FC_PVS_CULLED_TRIANGLE_COUNT = 0;
+thread_local unsigned FC_OCCLUSION_QUERY_WAIT_COUNT = 0;
+thread_local unsigned FC_LOD_NODE_COUNT = 0;
+thread_local unsigned FC_LOD_TRIANGLE_COUNT = 0;
+thread_local unsigned FC_VISIBLE_SET_CACHE_HIT_COUNT = 0;
+thread_local unsigned FC_VISIBLE_SET_CACHE_MISS_COUNT = 0;
+thread_local unsigned FC_GUARD_BAND_RECULL_COUNT = 0;
+thread_local unsigned FC_GPU_CULLING_VISIBLE_LEAF_COUNT = 0;
+thread_local unsigned FC_GPU_CULLING_MISMATCH_COUNT = 0;
+thread_local unsigned FC_MESHLET_CULLED_TRIANGLE_COUNT = 0;
+thread_local unsigned FC_TRIANGLE_CULLED_TRIANGLE_COUNT = 0;
+thread_local float FC_TRIANGLE_CULLING_TIME = 0;
+thread_local unsigned FC_EXACT_TEST_COUNT = 0;
+thread_local unsigned FC_EXACT_TEST_CULLED_TRIANGLE_COUNT = 0;
+thread_local unsigned FC_SPECULATIVE_CULLING_MISS_COUNT = 0;
+thread_local float FC_SPECULATIVE_TRAVERSE_TIME = 0;
+thread_local float FC_MULTI_VIEW_TRAVERSE_TIME = 0;
+thread_local float FC_INDEPENDENT_VIEWS_TRAVERSE_TIME = 0;
+
+TraversalCounters TraversalCounters::take() {
+	TraversalCounters c;
+	std::swap(c.nodeVisitedCount, FC_NODE_VISITED_COUNT);
+	std::swap(c.exactTestCount, FC_EXACT_TEST_COUNT);
+	std::swap(c.exactTestCulledTriangleCount, FC_EXACT_TEST_CULLED_TRIANGLE_COUNT);
+	std::swap(c.pvsCulledTriangleCount, FC_PVS_CULLED_TRIANGLE_COUNT);
+	std::swap(c.smallFeatureCulledTriangleCount, FC_SMALL_FEATURE_CULLED_TRIANGLE_COUNT);
+	std::swap(c.normalConeCulledTriangleCount, FC_NORMAL_CONE_CULLED_TRIANGLE_COUNT);
+	std::swap(c.lodNodeCount, FC_LOD_NODE_COUNT);
+	std::swap(c.meshletCulledTriangleCount, FC_MESHLET_CULLED_TRIANGLE_COUNT);
+	return c;
+}
+
+void TraversalCounters::add() const {
+	FC_NODE_VISITED_COUNT += nodeVisitedCount;
+	FC_EXACT_TEST_COUNT += exactTestCount;
+	FC_EXACT_TEST_CULLED_TRIANGLE_COUNT += exactTestCulledTriangleCount;
+	FC_PVS_CULLED_TRIANGLE_COUNT += pvsCulledTriangleCount;
+	FC_SMALL_FEATURE_CULLED_TRIANGLE_COUNT += smallFeatureCulledTriangleCount;
+	FC_NORMAL_CONE_CULLED_TRIANGLE_COUNT += normalConeCulledTriangleCount;
+	FC_LOD_NODE_COUNT += lodNodeCount;
+	FC_MESHLET_CULLED_TRIANGLE_COUNT += meshletCulledTriangleCount;
+}
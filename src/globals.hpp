@@ -9,10 +9,89 @@ extern bool OCTANT_TEST_ENABLED;
 extern bool PLANE_MASKING_ENABLED;
 extern bool PLANE_COHERENCY_ENABLED;
 extern bool CAMERA_COHERENCY_ENABLED;
+extern bool VISIBLE_SET_CACHE_ENABLED; // reuse the culling results of already seen camera poses
+extern bool GUARD_BAND_CACHING_ENABLED; // cull an enlarged frustum and reuse the result while the view stays inside it
+extern bool EXACT_CULLING_ENABLED;
+extern bool DRAW_RANGE_COALESCING_ENABLED;
+extern bool CAMERA_RELATIVE_CULLING_ENABLED; // frustum planes computed in double precision relative to the camera
+extern bool FRONT_TO_BACK_ORDERING_ENABLED; // the nearer child is traversed (and drawn) first
+extern bool SMALL_FEATURE_CULLING_ENABLED;
+extern bool NORMAL_CONE_CULLING_ENABLED; // used only if BF_CULLING_ENABLED
+extern bool OCCLUSION_CULLING_ENABLED;
+extern bool GPU_OCCLUSION_CULLING_ENABLED; // CHC++ hardware occlusion queries, takes precedence over OCCLUSION_CULLING_ENABLED
+extern bool GPU_FRUSTUM_CULLING_ENABLED; // BVH traversal in a compute shader, takes precedence over the CPU culling (except CHC++)
+extern bool GPU_CULLING_VALIDATION_ENABLED; // compare the GPU culling result with the CPU traversal every frame
+extern bool SPECULATIVE_CULLING_ENABLED; // cull the predicted next frame on a worker thread while drawing
+extern bool PVS_ENABLED; // used only if a PVS file is loaded
+extern bool LOD_ENABLED; // proxies are built when an object is loaded with LOD enabled
+extern bool VERTEX_CACHE_OPTIMIZATION_ENABLED; // the primitives of each leaf are reordered when an object is loaded with the optimization enabled
+extern bool VERTEX_COMPRESSION_ENABLED; // vertices are compressed when an object is loaded with compression enabled
+extern unsigned MESHLET_TRIANGLE_COUNT; // leaves are split into meshlets of at most this many primitives when an object is loaded (0 = no meshlets)
+extern bool MESHLET_CULLING_ENABLED; // cull the meshlets of the leaves intersecting the frustum (only the CPU frustum culling without occlusion culling)
+extern bool TRIANGLE_CULLING_ENABLED; // cull the triangles of the large leaves intersecting the frustum one by one (only the CPU frustum culling)
+extern unsigned TRIANGLE_CULLING_MIN_LEAF_SIZE; // min. number of primitives of a leaf whose triangles are culled
+extern bool LEAF_VERTEX_RANGES_ENABLED; // the vertices of each leaf are copied into their own range when an object is loaded with it enabled
+extern unsigned OCCLUDER_TRIANGLE_BUDGET; // max. number of triangles rasterized into the occlusion buffer per frame
+extern float SMALL_FEATURE_PIXEL_THRESHOLD; // nodes with smaller projected bounding sphere diameter are culled [px]
+extern float LOD_PIXEL_ERROR_THRESHOLD; // node proxies with smaller projected error are drawn instead of the subtree [px]
+extern float GUARD_BAND_ANGLE; // the side planes of the guard band frustum are rotated outwards by this angle [rad]
+extern float GUARD_BAND_MARGIN; // and all its planes are moved outwards by this distance [model space units]
+extern unsigned DRAW_RANGE_MERGE_GAP; // max. number of culled primitives between two merged draw ranges
+
+extern bool MULTI_DRAW_INDIRECT_ENABLED; // submit all visible ranges of an object by one glMultiDrawElementsIndirect
+
+extern unsigned MULTI_VIEW_COUNT; // number of views culled by the multi-view culling benchmark (1 = disabled)
 
 extern unsigned FC_TREE_DEPTH;
 extern unsigned FC_NODE_COUNT;
-extern unsigned FC_NODE_VISITED_COUNT;
-extern float FC_TRAVERSE_TIME; // [ms]
+// the per-frame counters are per thread, so that the speculative culling worker does not race with the main thread
+extern thread_local unsigned FC_NODE_VISITED_COUNT;
+extern thread_local float FC_TRAVERSE_TIME; // [ms]
+extern thread_local unsigned FC_DRAW_CALL_COUNT;
+extern thread_local unsigned FC_SMALL_FEATURE_CULLED_TRIANGLE_COUNT;
+extern thread_local unsigned FC_NORMAL_CONE_CULLED_TRIANGLE_COUNT;
+extern thread_local unsigned FC_OCCLUDER_TRIANGLE_COUNT;
+extern thread_local unsigned FC_OCCLUSION_CULLED_TRIANGLE_COUNT;
+extern thread_local float FC_OCCLUSION_TIME; // [ms] included in FC_TRAVERSE_TIME
+extern thread_local unsigned FC_OCCLUSION_QUERY_COUNT;
+extern thread_local unsigned FC_PVS_CULLED_TRIANGLE_COUNT;
+extern thread_local unsigned FC_OCCLUSION_QUERY_WAIT_COUNT; // query results which were not available when they were needed
+extern thread_local unsigned FC_LOD_NODE_COUNT; // nodes replaced by their proxy (before occlusion culling)
+extern thread_local unsigned FC_LOD_TRIANGLE_COUNT; // proxy triangles drawn
+extern thread_local unsigned FC_VISIBLE_SET_CACHE_HIT_COUNT;
+extern thread_local unsigned FC_VISIBLE_SET_CACHE_MISS_COUNT;
+extern thread_local unsigned FC_GUARD_BAND_RECULL_COUNT; // objects culled again because the view left their guard band
+extern thread_local unsigned FC_GPU_CULLING_VISIBLE_LEAF_COUNT; // leaves drawn after GPU frustum culling (GPUFrustumCuller::COUNTER_FRAME_COUNT frames late)
+extern thread_local unsigned FC_GPU_CULLING_MISMATCH_COUNT; // leaves culled differently by the GPU and the CPU
+extern thread_local unsigned FC_MESHLET_CULLED_TRIANGLE_COUNT;
+extern thread_local unsigned FC_TRIANGLE_CULLED_TRIANGLE_COUNT;
+extern thread_local float FC_TRIANGLE_CULLING_TIME; // [ms] included in FC_TRAVERSE_TIME
+extern thread_local unsigned FC_EXACT_TEST_COUNT;
+extern thread_local unsigned FC_EXACT_TEST_CULLED_TRIANGLE_COUNT;
+extern thread_local unsigned FC_SPECULATIVE_CULLING_MISS_COUNT; // objects culled synchronously because the prediction was wrong
+extern thread_local float FC_SPECULATIVE_TRAVERSE_TIME; // [ms] culling of the next frame on the worker thread, not included in FC_TRAVERSE_TIME
+extern thread_local float FC_MULTI_VIEW_TRAVERSE_TIME; // [ms]
+extern thread_local float FC_INDEPENDENT_VIEWS_TRAVERSE_TIME; // [ms]
+
+/** The per-frame counters written by the BVH frustum culling, used to move them from a worker thread to the main thread.
+ */
+struct TraversalCounters {
+	unsigned nodeVisitedCount = 0;
+	unsigned exactTestCount = 0;
+	unsigned exactTestCulledTriangleCount = 0;
+	unsigned pvsCulledTriangleCount = 0;
+	unsigned smallFeatureCulledTriangleCount = 0;
+	unsigned normalConeCulledTriangleCount = 0;
+	unsigned lodNodeCount = 0;
+	unsigned meshletCulledTriangleCount = 0;
+
+	/** Returns the counters of the calling thread and resets them.
+	 */
+	static TraversalCounters take();
+
+	/** Adds the counters to the ones of the calling thread.
+	 */
+	void add() const;
+};
 
 #endif /* GLOBALS_HPP_19_05_09_19_57_20 */
@@ -0,0 +1,208 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <glm/gtc/type_ptr.hpp>
+#include "gpuCulling.hpp"
+#include "utils.hpp"
+#include "globals.hpp"
+#include "ringBuffer.hpp"
+
+static const unsigned WORKGROUP_SIZE = 64; // local_size_x of the shader
+
+namespace {
+	/** Node layout of the shader storage buffer (std430).
+	 */
+	struct GPUNode {
+		glm::vec4 boundsMin;
+		glm::vec4 boundsMax;
+		glm::vec4 centroidRadius;
+		glm::uvec4 info; /// right child, first primitive, primitive count, base vertex
+	};
+
+	/** Shared by all cullers, it lives as long as the GL context.
+	 */
+	struct CullProgram {
+		GLuint program;
+		GLint planesLoc;
+		GLint octantPlaneTopLoc;
+		GLint octantPlaneFrontLoc;
+		GLint octantPlaneRightLoc;
+		GLint frustumCenterPlaneDistMinLoc;
+		GLint octantTestEnabledLoc;
+		GLint planeMaskingEnabledLoc;
+		GLint leafCountLoc;
+	};
+
+	const CullProgram& cullProgram() {
+		static CullProgram cp = [](){
+			CullProgram cp;
+			cp.program = loadShaderProgram({
+					{ GL_COMPUTE_SHADER, "../data/shaders/bvhCull.comp" },
+					});
+			if(!cp.program)
+				std::cerr << "Failed to load BVH culling shader program\n";
+			cp.planesLoc = glGetUniformLocation(cp.program, "Planes");
+			cp.octantPlaneTopLoc = glGetUniformLocation(cp.program, "OctantPlaneTop");
+			cp.octantPlaneFrontLoc = glGetUniformLocation(cp.program, "OctantPlaneFront");
+			cp.octantPlaneRightLoc = glGetUniformLocation(cp.program, "OctantPlaneRight");
+			cp.frustumCenterPlaneDistMinLoc = glGetUniformLocation(cp.program, "FrustumCenterPlaneDistMin");
+			cp.octantTestEnabledLoc = glGetUniformLocation(cp.program, "OctantTestEnabled");
+			cp.planeMaskingEnabledLoc = glGetUniformLocation(cp.program, "PlaneMaskingEnabled");
+			cp.leafCountLoc = glGetUniformLocation(cp.program, "LeafCount");
+			return cp;
+		}();
+		return cp;
+	}
+}
+
+GPUFrustumCuller::GPUFrustumCuller():
+	_frame{0},
+	_nodeCount{0},
+	_nodeBuffer{0},
+	_leafBuffer{0},
+	_commandBuffer{0},
+	_counterBuffers{},
+	_counters{},
+	_counterFences{}
+{}
+
+GPUFrustumCuller::~GPUFrustumCuller() {
+	if(_nodeBuffer) {
+		glDeleteBuffers(1, &_nodeBuffer);
+		glDeleteBuffers(1, &_leafBuffer);
+		glDeleteBuffers(1, &_commandBuffer);
+		glDeleteBuffers(COUNTER_FRAME_COUNT, _counterBuffers);
+	}
+	for(GLsync f : _counterFences)
+		if(f)
+			glDeleteSync(f);
+}
+
+void GPUFrustumCuller::upload(const BVH& bvh, const IndexBufferLayout& indexLayout) {
+	if(!_nodeBuffer) {
+		glGenBuffers(1, &_nodeBuffer);
+		glGenBuffers(1, &_leafBuffer);
+		glGenBuffers(1, &_commandBuffer);
+		glGenBuffers(COUNTER_FRAME_COUNT, _counterBuffers);
+		GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		for(unsigned i = 0; i < COUNTER_FRAME_COUNT; ++i) {
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, _counterBuffers[i]);
+			glBufferStorage(GL_SHADER_STORAGE_BUFFER, 2*sizeof(GLuint), nullptr, flags);
+			_counters[i] = static_cast<GLuint*>(glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, 2*sizeof(GLuint), flags));
+			_counters[i][0] = _counters[i][1] = 0;
+		}
+	}
+	_nodeCount = bvh.getNodeCount();
+	_frame = 0;
+	_leaves.clear();
+	std::vector<glm::uvec4> leafParts;
+	std::vector<GPUNode> nodes(_nodeCount);
+	for(unsigned n = 0; n < _nodeCount; ++n) {
+		// the same bounding sphere as in BVH::compress
+		const AABB& b = bvh.getNodeBounds(n);
+		const NodePrimitives& r = bvh.getNodePrimitiveRanges()[n];
+		glm::vec3 centroid = b.centroid();
+		nodes[n] = {
+			glm::vec4(b.min, 0),
+			glm::vec4(b.max, 0),
+			glm::vec4(centroid, glm::length(centroid-b.min)),
+			glm::uvec4(bvh.isLeaf(n) ? n+1 : bvh.getRightChild(n), r.first, r.count, indexLayout.baseVertex(r.first)),
+		};
+		// a leaf with several materials is drawn by one command per material
+		if(bvh.isLeaf(n))
+			indexLayout.splitRange(r, [&](unsigned first, unsigned count, const PrimitiveVertexRange& vr) {
+					leafParts.push_back(glm::uvec4(n, first, count, vr.material));
+					_leaves.push_back(n);
+					});
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, _nodeBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, nodes.size()*sizeof(GPUNode), nodes.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, _leafBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, leafParts.size()*sizeof(glm::uvec4), leafParts.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, _commandBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, _leaves.size()*sizeof(DrawElementsIndirectCommand), nullptr, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+unsigned GPUFrustumCuller::render(const BVH& bvh, const Frustum& frustum, const IndexBufferLayout& indexLayout) {
+	if(_nodeCount != bvh.getNodeCount())
+		upload(bvh, indexLayout);
+	const CullProgram& cp = cullProgram();
+
+	// the counters of the render which used this buffer last, they are reset for this one
+	unsigned counterI = _frame%COUNTER_FRAME_COUNT;
+	++_frame;
+	GLuint counters[2] = {0, 0};
+	GLsync& fence = _counterFences[counterI];
+	if(fence) {
+		waitForFence(fence);
+		glDeleteSync(fence);
+		fence = nullptr;
+		std::copy(_counters[counterI], _counters[counterI]+2, counters);
+	}
+	_counters[counterI][0] = _counters[counterI][1] = 0;
+	GLuint counterBuffer = _counterBuffers[counterI];
+
+	// the same octant planes as in BVH::FrustumTestData
+	Plane octantPlaneFront = planeFromNormalAndPoint(frustum.lookDir, frustum.center);
+	Plane octantPlaneRight = planeFromNormalAndPoint(glm::cross(frustum.lookDir, frustum.up), frustum.center);
+	Plane octantPlaneTop = planeFromNormalAndPoint(glm::cross(glm::vec3(octantPlaneRight), frustum.lookDir), frustum.center);
+	float frustCenterPlaneDistMin = std::numeric_limits<float>::max();
+	for(const Plane& p : frustum.planes)
+		frustCenterPlaneDistMin = fmin(frustCenterPlaneDistMin, glm::dot(p, glm::vec4(frustum.center, 1)));
+
+	GLint program;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+	glUseProgram(cp.program);
+	glUniform4fv(cp.planesLoc, frustum.planes.size(), glm::value_ptr(frustum.planes[0]));
+	glUniform4fv(cp.octantPlaneTopLoc, 1, glm::value_ptr(octantPlaneTop));
+	glUniform4fv(cp.octantPlaneFrontLoc, 1, glm::value_ptr(octantPlaneFront));
+	glUniform4fv(cp.octantPlaneRightLoc, 1, glm::value_ptr(octantPlaneRight));
+	glUniform1f(cp.frustumCenterPlaneDistMinLoc, frustCenterPlaneDistMin);
+	glUniform1i(cp.octantTestEnabledLoc, OCTANT_TEST_ENABLED);
+	glUniform1i(cp.planeMaskingEnabledLoc, PLANE_MASKING_ENABLED);
+	glUniform1ui(cp.leafCountLoc, _leaves.size());
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, _nodeBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, _leafBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, _commandBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, counterBuffer);
+	glDispatchCompute((_leaves.size()+WORKGROUP_SIZE-1)/WORKGROUP_SIZE, 1, 1);
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT | GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+	fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glUseProgram(program);
+
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, _commandBuffer);
+	glMultiDrawElementsIndirect(GL_TRIANGLES, indexLayout.type, nullptr, _leaves.size(), 0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	++FC_DRAW_CALL_COUNT;
+	FC_GPU_CULLING_VISIBLE_LEAF_COUNT += counters[0];
+	return counters[1];
+}
+
+unsigned GPUFrustumCuller::validate(BVH& bvh, const Frustum& frustum) {
+	if(_nodeCount != bvh.getNodeCount())
+		return 0;
+	std::vector<DrawElementsIndirectCommand> commands(_leaves.size());
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, _commandBuffer);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, commands.size()*sizeof(DrawElementsIndirectCommand), commands.data());
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	// a leaf is visible on the CPU if its primitives are covered by a visible node
+	const std::vector<NodePrimitives>& ranges = bvh.getNodePrimitiveRanges();
+	std::vector<bool> primitiveVisible(ranges[0].count, false);
+	for(unsigned n : bvh.nodesInFrustum(frustum))
+		std::fill(primitiveVisible.begin()+ranges[n].first, primitiveVisible.begin()+ranges[n].first+ranges[n].count, true);
+	unsigned mismatchCount = 0;
+	for(unsigned i = 0; i < _leaves.size(); ++i) {
+		const NodePrimitives& r = ranges[_leaves[i]];
+		bool cpuVisible = r.count > 0 && primitiveVisible[r.first];
+		bool gpuVisible = commands[i].count > 0;
+		if(cpuVisible != gpuVisible && r.count > 0) {
+			if(mismatchCount == 0)
+				std::cerr << "GPU culling mismatch: leaf " << _leaves[i] << " is " << (gpuVisible ? "visible" : "culled") << " on the GPU\n";
+			++mismatchCount;
+		}
+	}
+	return mismatchCount;
+}
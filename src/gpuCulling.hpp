@@ -0,0 +1,59 @@
+/** @file */
+#ifndef GPUCULLING_HPP_26_10_19_19_12_44
+#define GPUCULLING_HPP_26_10_19_19_12_44
+#include <vector>
+#include "bvh.hpp"
+#include "indexBufferLayout.hpp"
+
+/** Frustum culling of BVH leaves by a compute shader (data/shaders/bvhCull.comp).
+ * The nodes are uploaded to a shader storage buffer and each leaf is tested by its own invocation,
+ * which walks from the root to the leaf with the octant test and plane masking like the CPU traversal.
+ * The shader writes one indirect draw command per leaf and material (count 0 if culled) and the visible leaves are drawn
+ * by a single glMultiDrawElementsIndirect, so it needs only GL 4.5 (no indirect count extension).
+ * Small feature, normal cone, PVS, LOD and exact culling are not done on the GPU.
+ */
+class GPUFrustumCuller {
+	public:
+		static const unsigned COUNTER_FRAME_COUNT = 3;
+
+		GPUFrustumCuller();
+		~GPUFrustumCuller();
+
+		GPUFrustumCuller(const GPUFrustumCuller&) = delete;
+		GPUFrustumCuller& operator=(const GPUFrustumCuller&) = delete;
+
+		GPUFrustumCuller(GPUFrustumCuller&&) = default;
+		GPUFrustumCuller& operator=(GPUFrustumCuller&&) = default;
+
+		/** Culls and draws the leaves of the BVH as GL_TRIANGLES using the currently bound VAO and program.
+		 * The bound index buffer must be in the BVH primitive order and have the given layout.
+		 * The frustum is in model space.
+		 * Returns the number of triangles rendered COUNTER_FRAME_COUNT renders earlier.
+		 * The shader writes the counters into persistently mapped memory and they are read when their buffer is reused,
+		 * after the fence placed behind the dispatch has signaled, so the CPU waits only if the GPU is that many frames behind.
+		 */
+		unsigned render(const BVH& bvh, const Frustum& frustum, const IndexBufferLayout& indexLayout);
+
+		/** Reads back the draw commands of the last render and compares them with the leaves under the nodes
+		 * returned by BVH::nodesInFrustum for the same frustum. Waits for the GPU.
+		 * The CPU culling must not use the tests which are not done on the GPU.
+		 * Returns the number of leaves which were culled only by one of them.
+		 */
+		unsigned validate(BVH& bvh, const Frustum& frustum);
+
+	private:
+		/** Uploads the nodes and creates the draw command and counter buffers.
+		 */
+		void upload(const BVH& bvh, const IndexBufferLayout& indexLayout);
+
+		unsigned _frame;
+		unsigned _nodeCount;
+		std::vector<unsigned> _leaves; /// the command i draws (a material of) the leaf _leaves[i]
+		GLuint _nodeBuffer;
+		GLuint _leafBuffer;
+		GLuint _commandBuffer;
+		GLuint _counterBuffers[COUNTER_FRAME_COUNT]; /// draw and triangle count, used in turn by the renders
+		GLuint* _counters[COUNTER_FRAME_COUNT]; /// persistently mapped _counterBuffers
+		GLsync _counterFences[COUNTER_FRAME_COUNT]; /// placed after the dispatch which wrote the counters
+};
+#endif /* GPUCULLING_HPP_26_10_19_19_12_44 */
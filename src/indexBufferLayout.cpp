@@ -0,0 +1,102 @@
+#include <limits>
+#include "indexBufferLayout.hpp"
+#include "utils.hpp"
+
+IndexBufferLayout IndexBufferLayout::global(unsigned vertexCount) {
+	IndexBufferLayout l;
+	l.vertexRanges.push_back({0, 0, vertexCount});
+	return l;
+}
+
+unsigned IndexBufferLayout::indexSize() const {
+	return type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+}
+
+void IndexBufferLayout::splitMaterials(const std::vector<GLuint>& primitiveMaterials, unsigned materialCount) {
+	this->materialCount = materialCount;
+	if(materialCount <= 1)
+		return;
+	std::vector<PrimitiveVertexRange> ranges;
+	for(unsigned i = 0; i < vertexRanges.size(); ++i) {
+		unsigned end = i+1 < vertexRanges.size() ? vertexRanges[i+1].firstPrimitive : primitiveMaterials.size();
+		for(unsigned p = vertexRanges[i].firstPrimitive; p < end; ++p)
+			if(p == vertexRanges[i].firstPrimitive || primitiveMaterials[p] != primitiveMaterials[p-1]) {
+				ranges.push_back(vertexRanges[i]);
+				ranges.back().firstPrimitive = p;
+				ranges.back().material = primitiveMaterials[p];
+			}
+	}
+	if(!ranges.empty())
+		vertexRanges = std::move(ranges);
+}
+
+unsigned IndexBufferLayout::drawRange(const NodePrimitives& range) const {
+	unsigned drawCount = 0;
+	splitRange(range, [&](unsigned first, unsigned count, const PrimitiveVertexRange& vr) {
+			if(vr.material == 0)
+				glDrawRangeElementsBaseVertex(GL_TRIANGLES, 0, vr.vertexCount-1, count*3, type, BUFFER_OFFSET(indexSize()*3*first), vr.baseVertex);
+			else
+				glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, count*3, type, BUFFER_OFFSET(indexSize()*3*first), 1, vr.baseVertex, vr.material);
+			++drawCount;
+			});
+	return drawCount;
+}
+
+unsigned IndexBufferLayout::writeCommands(const NodePrimitives& range, DrawElementsIndirectCommand* commands) const {
+	unsigned commandCount = 0;
+	splitRange(range, [&](unsigned first, unsigned count, const PrimitiveVertexRange& vr) {
+			commands[commandCount++] = {count*3, 1, first*3, vr.baseVertex, vr.material};
+			});
+	return commandCount;
+}
+
+GLint IndexBufferLayout::baseVertex(unsigned primitive) const {
+	GLint b = 0;
+	splitRange({primitive, 1}, [&](unsigned, unsigned, const PrimitiveVertexRange& vr) {
+			b = vr.baseVertex;
+			});
+	return b;
+}
+
+IndexBufferLayout buildLeafVertexRanges(const BVH& bvh, const std::vector<unsigned>& indices, std::vector<Vertex>& vertices, std::vector<char>& indexData) {
+	IndexBufferLayout layout;
+	std::vector<Vertex> leafVertices;
+	std::vector<unsigned> localIndices(indices.size());
+	// the local index of the vertex is valid if it was last referenced by the current leaf
+	std::vector<unsigned> vertexLeaf(vertices.size(), unsigned(-1));
+	std::vector<unsigned> localIndex(vertices.size());
+	unsigned maxVertexCount = 0;
+	const std::vector<NodePrimitives>& ranges = bvh.getNodePrimitiveRanges();
+	for(unsigned n = 0; n < bvh.getNodeCount(); ++n) {
+		if(!bvh.isLeaf(n) || ranges[n].count == 0)
+			continue;
+		PrimitiveVertexRange vr{ranges[n].first, GLint(leafVertices.size()), 0};
+		for(unsigned i = ranges[n].first*3; i < (ranges[n].first+ranges[n].count)*3; ++i) {
+			unsigned v = indices[i];
+			if(vertexLeaf[v] != n) {
+				vertexLeaf[v] = n;
+				localIndex[v] = vr.vertexCount++;
+				leafVertices.push_back(vertices[v]);
+			}
+			localIndices[i] = localIndex[v];
+		}
+		maxVertexCount = std::max(maxVertexCount, vr.vertexCount);
+		layout.vertexRanges.push_back(vr);
+	}
+	if(layout.vertexRanges.empty())
+		layout.vertexRanges.push_back({0, 0, 0});
+	vertices = std::move(leafVertices);
+
+	if(maxVertexCount <= unsigned(std::numeric_limits<GLushort>::max())+1) {
+		layout.type = GL_UNSIGNED_SHORT;
+		indexData.resize(localIndices.size()*sizeof(GLushort));
+		GLushort* data = reinterpret_cast<GLushort*>(indexData.data());
+		for(unsigned i = 0; i < localIndices.size(); ++i)
+			data[i] = localIndices[i];
+	}
+	else {
+		indexData.resize(localIndices.size()*sizeof(GLuint));
+		std::copy(localIndices.begin(), localIndices.end(), reinterpret_cast<GLuint*>(indexData.data()));
+	}
+	return layout;
+}
@@ -0,0 +1,77 @@
+/** @file */
+#ifndef INDEXBUFFERLAYOUT_HPP_26_10_19_21_52_30
+#define INDEXBUFFERLAYOUT_HPP_26_10_19_21_52_30
+#include <algorithm>
+#include <vector>
+#include "types.hpp"
+#include "bvh.hpp"
+
+/** Part of the vertex buffer referenced by a run of primitives, their indices are relative to its base vertex.
+ * All primitives of the run have the same material.
+ */
+struct PrimitiveVertexRange {
+	unsigned firstPrimitive;
+	GLint baseVertex;
+	unsigned vertexCount;
+	GLuint material = 0; /// passed to the shader as the base instance of the draw
+};
+
+/** How the indices of the primitives (in BVH order) address the vertex buffer.
+ * Global indices form a single vertex range starting at vertex 0.
+ * With leaf vertex ranges (see LEAF_VERTEX_RANGES_ENABLED) each leaf has its own range and a primitive range spanning several leaves
+ * has to be drawn by one draw per leaf.
+ * With several materials the ranges are also split where the material changes, the material is the base instance of the draw.
+ */
+struct IndexBufferLayout {
+	GLenum type = GL_UNSIGNED_INT;
+	std::vector<PrimitiveVertexRange> vertexRanges; /// sorted by the first primitive
+	unsigned materialCount = 1;
+
+	/** Layout of 32 bit indices into the whole vertex buffer.
+	 */
+	static IndexBufferLayout global(unsigned vertexCount);
+
+	unsigned indexSize() const;
+
+	/** Splits the vertex ranges where the material of the primitives (in BVH order) changes.
+	 */
+	void splitMaterials(const std::vector<GLuint>& primitiveMaterials, unsigned materialCount);
+
+	/** Calls drawPart(first, count, vertexRange) for the parts of the primitive range in different vertex ranges.
+	 */
+	template<typename DrawPartF>
+	void splitRange(const NodePrimitives& range, DrawPartF drawPart) const {
+		auto it = std::upper_bound(vertexRanges.begin(), vertexRanges.end(), range.first, [](unsigned p, const PrimitiveVertexRange& vr) {
+				return p < vr.firstPrimitive;
+				}) - 1;
+		unsigned end = range.first + range.count;
+		for(unsigned first = range.first; first < end; ++it) {
+			unsigned partEnd = it+1 == vertexRanges.end() ? end : std::min(end, (it+1)->firstPrimitive);
+			drawPart(first, partEnd-first, *it);
+			first = partEnd;
+		}
+	}
+
+	/** Draws the primitive range from the bound index buffer by one glDrawRangeElementsBaseVertex per vertex range
+	 * (glDrawElementsInstancedBaseVertexBaseInstance for the ranges of other than the first material).
+	 * Returns the number of draw calls.
+	 */
+	unsigned drawRange(const NodePrimitives& range) const;
+
+	/** Writes one indirect draw command per vertex range of the primitive range and returns the number of commands.
+	 */
+	unsigned writeCommands(const NodePrimitives& range, DrawElementsIndirectCommand* commands) const;
+
+	/** Returns the base vertex of the primitive.
+	 */
+	GLint baseVertex(unsigned primitive) const;
+};
+
+/** Copies the vertices referenced by each leaf of the BVH into a contiguous range (vertices shared by leaves are duplicated),
+ * in the order of their first use, and makes the indices of each leaf local to its range.
+ * The indices are in the BVH primitive order, they are written as 16 bit if no leaf references more than 65536 vertices.
+ * The vertices are replaced by the leaf ranges and indexData by the index buffer contents.
+ */
+IndexBufferLayout buildLeafVertexRanges(const BVH& bvh, const std::vector<unsigned>& indices, std::vector<Vertex>& vertices, std::vector<char>& indexData);
+
+#endif /* INDEXBUFFERLAYOUT_HPP_26_10_19_21_52_30 */
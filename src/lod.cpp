@@ -0,0 +1,225 @@
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <queue>
+#include <tuple>
+#include <unordered_map>
+#include "lod.hpp"
+
+namespace {
+	/** Symmetric 4x4 matrix measuring the sum of squared distances to a set of planes.
+	 */
+	struct Quadric {
+		double a[10] = {}; // xx xy xz xw yy yz yw zz zw ww
+
+		Quadric() = default;
+
+		Quadric(const glm::dvec3& n, double d) {
+			a[0] = n.x*n.x; a[1] = n.x*n.y; a[2] = n.x*n.z; a[3] = n.x*d;
+			a[4] = n.y*n.y; a[5] = n.y*n.z; a[6] = n.y*d;
+			a[7] = n.z*n.z; a[8] = n.z*d;
+			a[9] = d*d;
+		}
+
+		Quadric& operator+=(const Quadric& q) {
+			for(unsigned i = 0; i < 10; ++i)
+				a[i] += q.a[i];
+			return *this;
+		}
+
+		double error(const glm::vec3& p) const {
+			double x = p.x, y = p.y, z = p.z;
+			return std::max(0.0,
+					a[0]*x*x + 2*a[1]*x*y + 2*a[2]*x*z + 2*a[3]*x
+					+ a[4]*y*y + 2*a[5]*y*z + 2*a[6]*y
+					+ a[7]*z*z + 2*a[8]*z
+					+ a[9]);
+		}
+	};
+
+	Quadric operator+(Quadric q1, const Quadric& q2) {
+		return q1 += q2;
+	}
+
+	struct Collapse {
+		double cost;
+		unsigned kept;
+		unsigned removed;
+		unsigned keptVersion;
+		unsigned removedVersion;
+		glm::vec3 position;
+
+		bool operator>(const Collapse& c) const {
+			return cost > c.cost;
+		}
+	};
+
+	uint64_t edgeKey(unsigned v1, unsigned v2) {
+		return uint64_t(std::min(v1, v2)) << 32 | std::max(v1, v2);
+	}
+}
+
+float simplifyMesh(std::vector<glm::vec3>& positions, std::vector<unsigned>& indices, unsigned targetTriangleCount) {
+	unsigned triangleCount = indices.size()/3;
+	if(triangleCount <= targetTriangleCount)
+		return 0;
+
+	// weld the vertices with the same position
+	std::map<std::tuple<float, float, float>, unsigned> weldedIndex;
+	std::vector<glm::vec3> pos;
+	for(unsigned& i : indices) {
+		const glm::vec3& p = positions[i];
+		auto it = weldedIndex.insert({std::make_tuple(p.x, p.y, p.z), unsigned(pos.size())}).first;
+		if(it->second == pos.size())
+			pos.push_back(p);
+		i = it->second;
+	}
+
+	std::vector<glm::uvec3> triangles(triangleCount);
+	std::vector<bool> triangleRemoved(triangleCount, false);
+	std::vector<std::vector<unsigned>> vertexTriangles(pos.size());
+	std::vector<Quadric> quadrics(pos.size());
+	std::unordered_map<uint64_t, unsigned> edgeUseCount;
+	for(unsigned t = 0; t < triangleCount; ++t) {
+		glm::uvec3 tri(indices[t*3+0], indices[t*3+1], indices[t*3+2]);
+		triangles[t] = tri;
+		if(tri.x == tri.y || tri.y == tri.z || tri.z == tri.x) {
+			triangleRemoved[t] = true;
+			continue;
+		}
+		glm::dvec3 p0 = glm::dvec3(pos[tri.x]), p1 = glm::dvec3(pos[tri.y]), p2 = glm::dvec3(pos[tri.z]);
+		glm::dvec3 n = glm::cross(p1-p0, p2-p0);
+		double length = glm::length(n);
+		if(length > 0) {
+			n /= length;
+			Quadric q(n, -glm::dot(n, p0));
+			for(unsigned i = 0; i < 3; ++i)
+				quadrics[tri[i]] += q;
+		}
+		for(unsigned i = 0; i < 3; ++i) {
+			vertexTriangles[tri[i]].push_back(t);
+			++edgeUseCount[edgeKey(tri[i], tri[(i+1)%3])];
+		}
+	}
+	// planes perpendicular to the boundary edges keep the boundary in place
+	for(unsigned t = 0; t < triangleCount; ++t) {
+		if(triangleRemoved[t])
+			continue;
+		const glm::uvec3& tri = triangles[t];
+		glm::dvec3 faceNormal = glm::cross(glm::dvec3(pos[tri.y]-pos[tri.x]), glm::dvec3(pos[tri.z]-pos[tri.x]));
+		for(unsigned i = 0; i < 3; ++i) {
+			unsigned v1 = tri[i], v2 = tri[(i+1)%3];
+			if(edgeUseCount[edgeKey(v1, v2)] != 1)
+				continue;
+			glm::dvec3 n = glm::cross(glm::dvec3(pos[v2]-pos[v1]), faceNormal);
+			double length = glm::length(n);
+			if(length == 0)
+				continue;
+			n /= length;
+			Quadric q(n, -glm::dot(n, glm::dvec3(pos[v1])));
+			quadrics[v1] += q;
+			quadrics[v2] += q;
+		}
+	}
+
+	std::vector<unsigned> version(pos.size(), 0);
+	std::vector<bool> vertexRemoved(pos.size(), false);
+	std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> collapses;
+	auto pushCollapse = [&](unsigned v1, unsigned v2) {
+		Quadric q = quadrics[v1] + quadrics[v2];
+		Collapse best = {q.error(pos[v1]), v1, v2, version[v1], version[v2], pos[v1]};
+		for(const glm::vec3& p : {pos[v2], (pos[v1]+pos[v2])/2.f}) {
+			double e = q.error(p);
+			if(e < best.cost) {
+				best.cost = e;
+				best.position = p;
+			}
+		}
+		collapses.push(best);
+	};
+	for(const auto& e : edgeUseCount)
+		pushCollapse(unsigned(e.first >> 32), unsigned(e.first & 0xffffffff));
+
+	// returns false if moving the vertex would flip any of its triangles which do not contain the other vertex
+	auto keepsOrientation = [&](unsigned v, unsigned other, const glm::vec3& newPosition) {
+		for(unsigned t : vertexTriangles[v]) {
+			if(triangleRemoved[t])
+				continue;
+			glm::uvec3 tri = triangles[t];
+			if(tri.x == other || tri.y == other || tri.z == other)
+				continue;
+			glm::vec3 before = glm::cross(pos[tri.y]-pos[tri.x], pos[tri.z]-pos[tri.x]);
+			glm::vec3 p[3] = {pos[tri.x], pos[tri.y], pos[tri.z]};
+			for(unsigned i = 0; i < 3; ++i)
+				if(tri[i] == v)
+					p[i] = newPosition;
+			glm::vec3 after = glm::cross(p[1]-p[0], p[2]-p[0]);
+			if(glm::dot(before, after) <= 0)
+				return false;
+		}
+		return true;
+	};
+
+	unsigned liveTriangleCount = std::count(triangleRemoved.begin(), triangleRemoved.end(), false);
+	double maxCost = 0;
+	while(liveTriangleCount > targetTriangleCount && !collapses.empty()) {
+		Collapse c = collapses.top();
+		collapses.pop();
+		if(vertexRemoved[c.kept] || vertexRemoved[c.removed]
+				|| version[c.kept] != c.keptVersion || version[c.removed] != c.removedVersion)
+			continue;
+		if(!keepsOrientation(c.kept, c.removed, c.position) || !keepsOrientation(c.removed, c.kept, c.position))
+			continue;
+
+		maxCost = std::max(maxCost, c.cost);
+		pos[c.kept] = c.position;
+		quadrics[c.kept] += quadrics[c.removed];
+		vertexRemoved[c.removed] = true;
+		++version[c.kept];
+		for(unsigned t : vertexTriangles[c.removed]) {
+			if(triangleRemoved[t])
+				continue;
+			glm::uvec3& tri = triangles[t];
+			if(tri.x == c.kept || tri.y == c.kept || tri.z == c.kept) {
+				triangleRemoved[t] = true;
+				--liveTriangleCount;
+				continue;
+			}
+			for(unsigned i = 0; i < 3; ++i)
+				if(tri[i] == c.removed)
+					tri[i] = c.kept;
+			vertexTriangles[c.kept].push_back(t);
+		}
+		vertexTriangles[c.removed].clear();
+
+		std::vector<unsigned>& keptTriangles = vertexTriangles[c.kept];
+		keptTriangles.erase(std::remove_if(keptTriangles.begin(), keptTriangles.end(), [&](unsigned t){ return triangleRemoved[t]; }), keptTriangles.end());
+		std::vector<unsigned> neighbours;
+		for(unsigned t : keptTriangles)
+			for(unsigned i = 0; i < 3; ++i)
+				if(triangles[t][i] != c.kept)
+					neighbours.push_back(triangles[t][i]);
+		std::sort(neighbours.begin(), neighbours.end());
+		neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+		for(unsigned n : neighbours)
+			pushCollapse(c.kept, n);
+	}
+
+	// compact
+	std::vector<unsigned> newIndex(pos.size(), unsigned(-1));
+	positions.clear();
+	indices.clear();
+	for(unsigned t = 0; t < triangleCount; ++t) {
+		if(triangleRemoved[t])
+			continue;
+		for(unsigned i = 0; i < 3; ++i) {
+			unsigned v = triangles[t][i];
+			if(newIndex[v] == unsigned(-1)) {
+				newIndex[v] = positions.size();
+				positions.push_back(pos[v]);
+			}
+			indices.push_back(newIndex[v]);
+		}
+	}
+	return float(std::sqrt(maxCost));
+}
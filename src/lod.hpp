@@ -0,0 +1,17 @@
+/** @file */
+#ifndef LOD_HPP_26_10_19_17_02_51
+#define LOD_HPP_26_10_19_17_02_51
+#include <vector>
+#include "types.hpp"
+
+/** Simplifies the triangle mesh by quadric error metric edge collapses until at most targetTriangleCount triangles remain
+ * or no more edges can be collapsed without flipping a triangle.
+ * Vertices with the same position are welded first. Boundary edges are preserved by additional perpendicular planes.
+ * The positions and indices are replaced by the simplified mesh.
+ * Returns the geometric error of the simplification (square root of the largest quadric error of a collapse).
+ *
+ * source article: Surface Simplification Using Quadric Error Metrics (Michael Garland and Paul S. Heckbert)
+ */
+float simplifyMesh(std::vector<glm::vec3>& positions, std::vector<unsigned>& indices, unsigned targetTriangleCount);
+
+#endif /* LOD_HPP_26_10_19_17_02_51 */
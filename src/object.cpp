@@ -1,6 +1,8 @@
 #include <iostream>
 #include <vector>
 #include <chrono>
+#include <algorithm>
+#include <cmath>
 #include <GL/glew.h>
 #include <GL/gl.h>
 #include <glm/glm.hpp>
@@ -8,14 +10,99 @@
 #include "utils.hpp"
 #include "object.hpp"
 #include "globals.hpp"
+#include "containment.hpp"
+#include "ringBuffer.hpp"
+
+static const unsigned LOD_PROXY_TRIANGLE_COUNT = 1024; // node proxies are simplified to this many triangles
+static const float POSITION_QUANTIZATION_MAX = 65535; // GL_UNSIGNED_SHORT normalized
+static const float NORMAL_QUANTIZATION_MAX = 32767; // GL_SHORT normalized
+
+/** FNV-1a of the data appended to the hash.
+ */
+static uint32_t hashBytes(uint32_t hash, const void* data, size_t size) {
+	for(size_t i = 0; i < size; ++i) {
+		hash ^= static_cast<const uint8_t*>(data)[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/** Returns the frustum enlarged by GUARD_BAND_ANGLE and GUARD_BAND_MARGIN.
+ * The side planes are rotated outwards (their normals towards the look direction) around the view point.
+ * The near and far planes are moved outwards as far as their corners move when the view rotates by the angle.
+ * All planes are then moved outwards by the margin.
+ */
+static Frustum guardBandFrustum(const Frustum& frustum) {
+	Frustum guardBand = frustum;
+	for(unsigned i = 0; i < guardBand.planes.size(); ++i) {
+		Plane& p = guardBand.planes[i];
+		if(i == Near || i == Far) {
+			glm::vec3 corner = planesIntersection(frustum.planes[i], frustum.planes[Top], frustum.planes[Right]);
+			p.w += glm::distance(corner, frustum.viewPoint)*std::sin(GUARD_BAND_ANGLE);
+		}
+		else {
+			glm::vec3 n(p);
+			glm::vec3 t = frustum.lookDir - glm::dot(frustum.lookDir, n)*n;
+			float tLength = glm::length(t);
+			if(tLength > 0) {
+				n = glm::normalize(n*std::cos(GUARD_BAND_ANGLE) + t/tLength*std::sin(GUARD_BAND_ANGLE));
+				p = planeFromNormalAndPoint(n, frustum.viewPoint);
+			}
+		}
+		p.w += GUARD_BAND_MARGIN;
+	}
+	return guardBand;
+}
+
+/** Projects the unit vector onto the octahedron |x|+|y|+|z| = 1 and unfolds the lower half over the diagonals into [-1,1]^2.
+ * Must match octahedralDecode in pt.vert.
+ */
+static glm::vec2 octahedralEncode(glm::vec3 n) {
+	float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+	if(!(l1 > 0))
+		return glm::vec2(0);
+	n /= l1;
+	glm::vec2 e(n.x, n.y);
+	if(n.z < 0)
+		e = glm::vec2((1 - std::abs(n.y))*(n.x >= 0 ? 1 : -1), (1 - std::abs(n.x))*(n.y >= 0 ? 1 : -1));
+	return e;
+}
+
+static glm::vec3 octahedralDecode(glm::vec2 e) {
+	glm::vec3 n(e.x, e.y, 1 - std::abs(e.x) - std::abs(e.y));
+	if(n.z < 0) {
+		n.x = (1 - std::abs(e.y))*(e.x >= 0 ? 1 : -1);
+		n.y = (1 - std::abs(e.x))*(e.y >= 0 ? 1 : -1);
+	}
+	return glm::normalize(n);
+}
 
 Object::Object(const std::string& fileName): 
 	_queryID{0},
 	_vao{0},
 	_indexBuffer{0},
 	_vertexBuffer{0},
+	_lodQueryIDs{0, 0},
+	_lodVao{0},
+	_lodIndexBuffer{0},
+	_lodVertexBuffer{0},
+	_materialIDBuffer{0},
+	_compressedVertices{VERTEX_COMPRESSION_ENABLED},
+	_positionOffset{0},
+	_positionScale{1},
 	_transform{1},
-	_queryActive{false}
+	_drawTime{0},
+	_lodDrawTime{0},
+	_lodQueryActive{false},
+	_queryActive{false},
+	_prevCullingSettings{0},
+	_guardBandValid{false},
+	_guardBandSettings{0},
+	_layoutSettings{0},
+	_pvsCellLeaves{nullptr},
+	_speculativeCullingActive{false},
+	_speculativeRangesValid{false},
+	_speculativeTraverseTime{0}
 {
 	objLoader objData;
 	std::vector<char> fileNameCharArray(fileName.begin(), fileName.end());
@@ -41,10 +128,15 @@ Object::Object(const std::string& fileName):
 		primitivesInfo[i].indices[0] = face.vertex_index[0];
 		primitivesInfo[i].indices[1] = face.vertex_index[1];
 		primitivesInfo[i].indices[2] = face.vertex_index[2];
+		// faces before the first usemtl have no material
+		primitivesInfo[i].material = std::max(face.material_index, 0);
 		glm::vec3 &v1 = vertices[face.vertex_index[0]].position,
 			&v2 = vertices[face.vertex_index[1]].position,
 			&v3 = vertices[face.vertex_index[2]].position;
 		primitivesInfo[i].centroid = (v1 + v2 + v3)/3.f;
+		glm::vec3 frontFaceNormal = glm::cross(v2-v1, v3-v1);
+		float frontFaceNormalLength = glm::length(frontFaceNormal);
+		primitivesInfo[i].normal = frontFaceNormalLength > 0 ? frontFaceNormal/frontFaceNormalLength : glm::vec3(0);
 		if(objData.normalCount > 0) {
 			const obj_vector& n0 = *objData.normalList[face.normal_index[0]];
 			const obj_vector& n1 = *objData.normalList[face.normal_index[1]];
@@ -62,12 +154,17 @@ Object::Object(const std::string& fileName):
 		}
 	}
 	_triangleCount = objData.faceCount;
+	_positions.reserve(vertices.size());
 	for(Vertex& v : vertices) {
 		v.normal = glm::normalize(v.normal);
+		_positions.push_back(v.position);
 	}
 
 	std::vector<unsigned> primitiveOrder = _bvh.build(vertices, primitivesInfo, MAX_PRIMITIVES_IN_LEAF);
-	std::vector<unsigned int> indices(objData.faceCount*3);
+	if(!_bvh.getMeshlets().empty())
+		std::cout << "Meshlets: " << _bvh.getMeshlets().size() << ", " << float(primitiveOrder.size())/_bvh.getMeshlets().size() << " triangles per meshlet on average\n";
+	std::vector<unsigned int>& indices = _indices;
+	indices.resize(objData.faceCount*3);
 	for(unsigned i = 0; i < primitiveOrder.size(); ++i) {
 		unsigned primID = primitiveOrder[i];
 		indices[i*3+0] = primitivesInfo[primID].indices[0];
@@ -75,49 +172,168 @@ Object::Object(const std::string& fileName):
 		indices[i*3+2] = primitivesInfo[primID].indices[2];
 	}
 
-	if(objData.materialCount >= 1) {
-		obj_material& om = *objData.materialList[0];
-		Material& m = _material;
-
-		if(objData.materialCount > 1)
-			std::cerr << "Only one material is supported. Using the first material ("
-				<< om.name << ") for the entire model ... \n";
-
+	for(int i = 0; i < objData.materialCount; ++i) {
+		obj_material& om = *objData.materialList[i];
+		Material m;
 		//TODO per channel Ka, Kd, Ks
 		m.ambientK = om.amb[0];
 		m.diffuseK = om.diff[0];
 		m.specularK = om.spec[0];
 		m.shininess = om.shiny;
 		m.color = {1,1,1,1};
+		_materials.push_back(m);
 	}
-	else {
+	if(_materials.empty()) {
 		std::cerr << "The model does not contain material/s ... setting Kd=1, Ks=Ka=Alpha=0\n";
-		_material.diffuseK = 1;
+		Material m;
+		m.ambientK = 0;
+		m.diffuseK = 1;
+		m.specularK = 0;
+		m.shininess = 0;
+		_materials.push_back(m);
+	}
+	std::vector<GLuint> primitiveMaterials(primitiveOrder.size());
+	for(unsigned i = 0; i < primitiveOrder.size(); ++i)
+		primitiveMaterials[i] = std::min<unsigned>(primitivesInfo[primitiveOrder[i]].material, _materials.size()-1);
+
+	std::vector<Vertex> lodVertices;
+	std::vector<unsigned> lodIndices;
+	if(LOD_ENABLED) {
+		_bvh.buildProxies(vertices, primitivesInfo, primitiveOrder, LOD_PROXY_TRIANGLE_COUNT, lodVertices, lodIndices);
+		std::cout << "LOD proxies: " << lodIndices.size()/3 << " triangles\n";
+	}
+
+	if(_compressedVertices) {
+		// the proxies share the object data of the shader, so they are quantized in the same bounds
+		AABB bounds = _aabb;
+		for(const Vertex& v : lodVertices)
+			bounds.unite(v.position);
+		_positionOffset = bounds.min;
+		_positionScale = bounds.max - bounds.min;
 	}
 
 	glGenQueries(1, &_queryID);
 
+	// the material of a draw is its base instance, the instanced attribute maps it to itself
+	std::vector<GLuint> materialIDs(_materials.size());
+	for(unsigned i = 0; i < materialIDs.size(); ++i)
+		materialIDs[i] = i;
+	glGenBuffers(1, &_materialIDBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, _materialIDBuffer);
+	glBufferData(GL_ARRAY_BUFFER, materialIDs.size()*sizeof(GLuint), materialIDs.data(), GL_STATIC_DRAW);
+
 	glGenVertexArrays(1, &_vao);
 	glBindVertexArray(_vao);
 
 	glGenBuffers(1, &_indexBuffer);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _indexBuffer);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+	if(LEAF_VERTEX_RANGES_ENABLED) {
+		// the CPU copies (_positions, _indices) keep the global vertex order
+		size_t vertexCount = vertices.size();
+		std::vector<char> indexData;
+		_indexLayout = buildLeafVertexRanges(_bvh, indices, vertices, indexData);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexData.size(), indexData.data(), GL_STATIC_DRAW);
+		std::cout << "Leaf vertex ranges: " << vertexCount << " -> " << vertices.size() << " vertices, "
+			<< _indexLayout.indexSize()*8 << " bit indices, index buffer " << indices.size()*sizeof(unsigned)/1e6 << " -> " << indexData.size()/1e6 << " MB\n";
+		// the triangle culling copies the surviving indices from it
+		_leafIndexData = std::move(indexData);
+	}
+	else {
+		_indexLayout = IndexBufferLayout::global(vertices.size());
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+	}
+
+	_indexLayout.splitMaterials(primitiveMaterials, _materials.size());
+	if(_materials.size() > 1)
+		std::cout << "Materials: " << _materials.size() << ", " << _indexLayout.vertexRanges.size() << " draw ranges of one material and vertex range\n";
+	_streamedIndexLayout.type = _indexLayout.type;
+	_streamedIndexLayout.materialCount = _indexLayout.materialCount;
+	unsigned layoutSettings[] = {
+		MAX_PRIMITIVES_IN_LEAF, MESHLET_TRIANGLE_COUNT, VERTEX_CACHE_OPTIMIZATION_ENABLED, LEAF_VERTEX_RANGES_ENABLED,
+		_indexLayout.materialCount,
+	};
+	_layoutSettings = hashBytes(2166136261u, layoutSettings, sizeof(layoutSettings));
+	for(unsigned n = 0; n < _bvh.getNodeCount(); ++n)
+		if(_bvh.isLeaf(n) && _bvh.getNodePrimitiveRanges()[n].count > 0)
+			_leafNodes.push_back(n);
 
 	glGenBuffers(1, &_vertexBuffer);
 	glBindBuffer(GL_ARRAY_BUFFER, _vertexBuffer);
-	glBufferData(GL_ARRAY_BUFFER, _vertexCount*sizeof(Vertex), vertices.data(), GL_STATIC_DRAW);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), 0);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), BUFFER_OFFSET(offsetof(Vertex, normal)));
-	glEnableVertexAttribArray(0);
-	glEnableVertexAttribArray(1);
+	float maxNormalError = uploadVertices(vertices);
+
+	if(!lodIndices.empty()) {
+		glGenQueries(2, _lodQueryIDs);
+		glGenVertexArrays(1, &_lodVao);
+		glBindVertexArray(_lodVao);
+
+		glGenBuffers(1, &_lodIndexBuffer);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _lodIndexBuffer);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, lodIndices.size() * sizeof(unsigned int), lodIndices.data(), GL_STATIC_DRAW);
+		_lodIndexLayout = IndexBufferLayout::global(lodVertices.size());
+
+		glGenBuffers(1, &_lodVertexBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, _lodVertexBuffer);
+		maxNormalError = std::max(maxNormalError, uploadVertices(lodVertices));
+		glBindVertexArray(_vao);
+	}
+
+	if(_compressedVertices) {
+		size_t vertexCount = vertices.size() + lodVertices.size();
+		// rounding to the nearest step, the error is at most half of the step on each axis
+		float maxPositionError = glm::length(_positionScale)/POSITION_QUANTIZATION_MAX/2;
+		std::cout << "Compressed vertices: " << sizeof(Vertex) << " -> " << sizeof(CompressedVertex) << " B, saved "
+			<< vertexCount*(sizeof(Vertex)-sizeof(CompressedVertex))/1e6 << " MB, max. position error "
+			<< maxPositionError << ", max. normal error " << glm::degrees(maxNormalError) << " deg\n";
+	}
 }
 
 Object::~Object() {
+	if(_speculativeCullingActive)
+		speculativeCullingWorker().wait();
 	glDeleteQueries(1, &_queryID);
 	glDeleteVertexArrays(1, &_vao);
 	glDeleteBuffers(1, &_indexBuffer);
 	glDeleteBuffers(1, &_vertexBuffer);
+	if(_lodVao) {
+		glDeleteQueries(2, _lodQueryIDs);
+		glDeleteVertexArrays(1, &_lodVao);
+		glDeleteBuffers(1, &_lodIndexBuffer);
+		glDeleteBuffers(1, &_lodVertexBuffer);
+	}
+	glDeleteBuffers(1, &_materialIDBuffer);
+}
+
+float Object::uploadVertices(const std::vector<Vertex>& vertices) {
+	float maxNormalError = 0;
+	if(!_compressedVertices) {
+		glBufferData(GL_ARRAY_BUFFER, vertices.size()*sizeof(Vertex), vertices.data(), GL_STATIC_DRAW);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), 0);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), BUFFER_OFFSET(offsetof(Vertex, normal)));
+	}
+	else {
+		std::vector<CompressedVertex> compressed(vertices.size());
+		for(unsigned i = 0; i < vertices.size(); ++i) {
+			CompressedVertex& c = compressed[i];
+			for(unsigned a = 0; a < 3; ++a)
+				c.position[a] = _positionScale[a] > 0 ? std::round((vertices[i].position[a] - _positionOffset[a])/_positionScale[a]*POSITION_QUANTIZATION_MAX) : 0;
+			c.position[3] = 0;
+			glm::vec2 e = glm::round(octahedralEncode(vertices[i].normal)*NORMAL_QUANTIZATION_MAX);
+			c.normal[0] = e.x;
+			c.normal[1] = e.y;
+			glm::vec3 n = octahedralDecode(e/NORMAL_QUANTIZATION_MAX);
+			maxNormalError = std::max(maxNormalError, std::acos(std::min(glm::dot(n, vertices[i].normal), 1.f)));
+		}
+		glBufferData(GL_ARRAY_BUFFER, compressed.size()*sizeof(CompressedVertex), compressed.data(), GL_STATIC_DRAW);
+		glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(CompressedVertex), 0);
+		glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(CompressedVertex), BUFFER_OFFSET(offsetof(CompressedVertex, normal)));
+	}
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glBindBuffer(GL_ARRAY_BUFFER, _materialIDBuffer);
+	glVertexAttribIPointer(2, 1, GL_UNSIGNED_INT, sizeof(GLuint), 0);
+	glVertexAttribDivisor(2, 1);
+	glEnableVertexAttribArray(2);
+	return maxNormalError;
 }
 
 void Object::setPosition(glm::vec3 pos) {
@@ -134,6 +350,10 @@ double Object::getDrawTime() const {
 	return _drawTime;
 }
 
+double Object::getLodDrawTime() const {
+	return _lodDrawTime;
+}
+
 unsigned Object::getRenderedTriangleCount() const {
 	return _renderedTriangleCount;
 }
@@ -146,15 +366,51 @@ glm::mat4 Object::getTransform() const {
 	return _transform;
 }
 
-Material& Object::getMaterial() {
-	return _material;
+const std::vector<Material>& Object::getMaterials() const {
+	return _materials;
 }
 
 const AABB& Object::getAABB() const {
 	return _aabb;
 }
 
-void Object::draw(const std::vector<Plane>& frustumPlanes, const glm::vec3& frustumCenter, const glm::vec3& lookDir, const glm::vec3& up, bool doTimerQuery) {
+void Object::setVisibleSetCacheBudget(size_t bytes) {
+	_visibleSetCache.setMemoryBudget(bytes);
+}
+
+bool Object::saveVisibleSetCache(const std::string& fileName) const {
+	return _visibleSetCache.save(fileName, _bvh.getNodeCount(), visibleSetCacheSignature());
+}
+
+bool Object::loadVisibleSetCache(const std::string& fileName) {
+	unsigned proxyTriangleCount = 0;
+	for(const NodeProxy& p : _bvh.getNodeProxies())
+		proxyTriangleCount = std::max(proxyTriangleCount, p.primitives.first + p.primitives.count);
+	return _visibleSetCache.load(fileName, _bvh.getNodeCount(), visibleSetCacheSignature(), getTriangleCount(), proxyTriangleCount);
+}
+
+bool Object::buildPVS(const std::vector<glm::vec3>& routePoints, float cellSize, unsigned raysPerCell, const std::string& fileName) {
+	glm::mat4 modelInverse = glm::inverse(_transform);
+	std::vector<glm::vec3> modelSpaceRoute;
+	for(const glm::vec3& p : routePoints)
+		modelSpaceRoute.push_back(glm::vec3(modelInverse*glm::vec4(p, 1)));
+	// the object transform is only a translation
+	_pvs.build(_bvh, _positions, _indices, modelSpaceRoute, cellSize, raysPerCell);
+	return _pvs.save(fileName);
+}
+
+bool Object::loadPVS(const std::string& fileName) {
+	if(!_pvs.load(fileName))
+		return false;
+	if(_pvs.getNodeCount() != _bvh.getNodeCount()) {
+		std::cerr << "The PVS was built for a different BVH.\n";
+		_pvs = PVS();
+		return false;
+	}
+	return true;
+}
+
+void Object::draw(const Frustum& frustum, OcclusionBuffer* occlusionBuffer, const Frustum* nextFrustum, bool doTimerQuery) {
 	glBindVertexArray(_vao);
 	GLuint64 qr = GL_FALSE;
 	if(_queryActive && doTimerQuery)
@@ -167,36 +423,393 @@ void Object::draw(const std::vector<Plane>& frustumPlanes, const glm::vec3& frus
 	}
 	if(!_queryActive && doTimerQuery) {
 		glBeginQuery(GL_TIME_ELAPSED, _queryID);
-		doDrawing(frustumPlanes, frustumCenter, lookDir, up);
+		doDrawing(frustum, occlusionBuffer, nextFrustum);
 		glEndQuery(GL_TIME_ELAPSED);
 		_queryActive = true;
 	}
 	else
-		doDrawing(frustumPlanes, frustumCenter, lookDir, up);
+		doDrawing(frustum, occlusionBuffer, nextFrustum);
 }
 
-void Object::doDrawing(const std::vector<Plane>& frustumPlanes, const glm::vec3& frustumCenter, const glm::vec3& lookDir, const glm::vec3& up) {
-	const std::vector<unsigned> *visibleNodes = &_visibleNodes;
+void Object::doDrawing(const Frustum& frustum, OcclusionBuffer* occlusionBuffer, const Frustum* nextFrustum) {
+	const std::vector<NodePrimitives> *visibleRanges = &_visibleRanges;
 	auto start = std::chrono::steady_clock::now();
-	if(FRUSTUM_CULLING_ENABLED) {
+	if(FRUSTUM_CULLING_ENABLED && GPU_OCCLUSION_CULLING_ENABLED) {
+		_renderedTriangleCount = _chc.render(_bvh, frustum, _indexLayout);
+		// includes issuing the draw calls and waiting for the query results
+		FC_TRAVERSE_TIME += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now()-start).count()/1000.f;
+		return;
+	}
+	if(FRUSTUM_CULLING_ENABLED && GPU_FRUSTUM_CULLING_ENABLED) {
+		_renderedTriangleCount = _gpuCuller.render(_bvh, frustum, _indexLayout);
+		// includes only the dispatch and the draw call
+		FC_TRAVERSE_TIME += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now()-start).count()/1000.f;
+		if(GPU_CULLING_VALIDATION_ENABLED) {
+			if(_pvsCellLeaves) {
+				_bvh.restrictToLeaves(nullptr);
+				_pvsCellLeaves = nullptr;
+			}
+			unsigned visitedNodeCount = FC_NODE_VISITED_COUNT;
+			FC_GPU_CULLING_MISMATCH_COUNT += _gpuCuller.validate(_bvh, frustum);
+			FC_NODE_VISITED_COUNT = visitedNodeCount;
+		}
+		_guardBandValid = false;
+		return;
+	}
+	bool speculate = FRUSTUM_CULLING_ENABLED && SPECULATIVE_CULLING_ENABLED && !occlusionBuffer;
+	if(speculate) {
+		if(_speculativeRangesValid
+				&& _speculativeFrustum.viewPoint == frustum.viewPoint
+				&& _speculativeFrustum.modelViewProjection == frustum.modelViewProjection) {
+			std::swap(_visibleRanges, _speculativeRanges);
+			std::swap(_visibleProxyRanges, _speculativeProxyRanges);
+			_speculativeCounters.add();
+		}
+		else {
+			_visibleRanges = visiblePrimitiveRanges(frustum, occlusionBuffer, _visibleProxyRanges);
+			++FC_SPECULATIVE_CULLING_MISS_COUNT;
+		}
+		_speculativeRangesValid = false;
+	}
+	else if(FRUSTUM_CULLING_ENABLED && VISIBLE_SET_CACHE_ENABLED && !occlusionBuffer) {
+		VisibleSetCache::Key key = VisibleSetCache::key(frustum, cullingSettings());
+		if(const VisibleSet* cached = _visibleSetCache.find(key)) {
+			_visibleRanges = cached->ranges;
+			_visibleProxyRanges = cached->proxyRanges;
+			++FC_VISIBLE_SET_CACHE_HIT_COUNT;
+		}
+		else {
+			_visibleRanges = visiblePrimitiveRanges(frustum, occlusionBuffer, _visibleProxyRanges);
+			_visibleSetCache.insert(key, {_visibleRanges, _visibleProxyRanges});
+			++FC_VISIBLE_SET_CACHE_MISS_COUNT;
+		}
+	}
+	else if(FRUSTUM_CULLING_ENABLED && GUARD_BAND_CACHING_ENABLED && !occlusionBuffer) {
+		// the tests depending on the view point are only valid for the view point they were done from
+		uint32_t settings = cullingSettings();
+		if(!_guardBandValid || !frustumInPlanes(frustum.planes, _guardBandPlanes) || settings != _guardBandSettings
+				|| (frustum.viewPoint != _guardBandViewPoint && viewPointDependentCulling(frustum))) {
+			Frustum guardBand = guardBandFrustum(frustum);
+			_visibleRanges = visiblePrimitiveRanges(guardBand, occlusionBuffer, _visibleProxyRanges);
+			_guardBandPlanes = guardBand.planes;
+			_guardBandViewPoint = frustum.viewPoint;
+			_guardBandSettings = settings;
+			_guardBandValid = true;
+			++FC_GUARD_BAND_RECULL_COUNT;
+		}
+	}
+	else if(FRUSTUM_CULLING_ENABLED) {
 		if(CAMERA_COHERENCY_ENABLED) {
-			if(_prevFrustumCenter == frustumCenter)
+			uint32_t settings = cullingSettings();
+			if(_prevFrustumCenter == frustum.center && _prevCullingSettings == settings)
 				;
 			else {
-				_visibleNodes = _bvh.nodesInFrustum(frustumPlanes, frustumCenter, lookDir, up);
-				_prevFrustumCenter = frustumCenter;
+				_visibleRanges = visiblePrimitiveRanges(frustum, occlusionBuffer, _visibleProxyRanges);
+				_prevFrustumCenter = frustum.center;
+				_prevCullingSettings = settings;
 			}
 		}
 		else
-			visibleNodes = &_bvh.nodesInFrustum(frustumPlanes, frustumCenter, lookDir, up);
+			visibleRanges = &visiblePrimitiveRanges(frustum, occlusionBuffer, _visibleProxyRanges);
 	}
-	else
-		_visibleNodes = {0};
+	else {
+		_visibleRanges = {_bvh.getNodePrimitiveRanges()[0]};
+		_visibleProxyRanges.clear();
+	}
+	// the cached ranges may be stale once the guard band was not maintained
+	if(!(FRUSTUM_CULLING_ENABLED && GUARD_BAND_CACHING_ENABLED && !VISIBLE_SET_CACHE_ENABLED && !occlusionBuffer && !speculate))
+		_guardBandValid = false;
 	FC_TRAVERSE_TIME += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now()-start).count()/1000.f;
-	const std::vector<NodePrimitives>& nodePrimitives = _bvh.getNodePrimitiveRanges();
-	_renderedTriangleCount = 0;
-	for(const unsigned& nID: *visibleNodes) {
-		glDrawElements(GL_TRIANGLES, nodePrimitives[nID].count*3, GL_UNSIGNED_INT, BUFFER_OFFSET(sizeof(unsigned)*3*nodePrimitives[nID].first));
-		_renderedTriangleCount += nodePrimitives[nID].count;
+
+	// the worker only touches the BVH, the PVS and the speculative members
+	if(speculate && nextFrustum) {
+		_speculativeFrustum = *nextFrustum;
+		_speculativeCullingActive = true;
+		speculativeCullingWorker().run([this]() {
+				auto start = std::chrono::steady_clock::now();
+				TraversalCounters::take();
+				_speculativeRanges = visiblePrimitiveRanges(_speculativeFrustum, nullptr, _speculativeProxyRanges);
+				_speculativeCounters = TraversalCounters::take();
+				_speculativeTraverseTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now()-start).count()/1000.f;
+				});
+	}
+	if(FRUSTUM_CULLING_ENABLED && TRIANGLE_CULLING_ENABLED)
+		_renderedTriangleCount = drawRangesCullingTriangles(*visibleRanges, frustum);
+	else
+		_renderedTriangleCount = drawRanges(*visibleRanges, _indexLayout);
+	drawProxies();
+	if(_speculativeCullingActive) {
+		speculativeCullingWorker().wait();
+		_speculativeCullingActive = false;
+		_speculativeRangesValid = true;
+		FC_SPECULATIVE_TRAVERSE_TIME += _speculativeTraverseTime;
+	}
+}
+
+bool Object::viewPointDependentCulling(const Frustum& frustum) const {
+	return (BF_CULLING_ENABLED && NORMAL_CONE_CULLING_ENABLED)
+		|| SMALL_FEATURE_CULLING_ENABLED
+		|| (LOD_ENABLED && !_bvh.getNodeProxies().empty())
+		|| (PVS_ENABLED && _pvs.cellLeaves(frustum.viewPoint) != _pvsCellLeaves);
+}
+
+uint32_t Object::cullingSettings() const {
+	uint32_t hash = 2166136261u;
+	auto add = [&](const void* data, size_t size) {
+		hash = hashBytes(hash, data, size);
+	};
+	bool flags[] = {
+		BF_CULLING_ENABLED, OCTANT_TEST_ENABLED, PLANE_MASKING_ENABLED, PLANE_COHERENCY_ENABLED,
+		EXACT_CULLING_ENABLED, DRAW_RANGE_COALESCING_ENABLED, FRONT_TO_BACK_ORDERING_ENABLED, CAMERA_RELATIVE_CULLING_ENABLED,
+		SMALL_FEATURE_CULLING_ENABLED, NORMAL_CONE_CULLING_ENABLED, PVS_ENABLED && !_pvs.empty(),
+		LOD_ENABLED && !_bvh.getNodeProxies().empty(), MESHLET_CULLING_ENABLED && !_bvh.getMeshlets().empty(),
+	};
+	add(flags, sizeof(flags));
+	add(&SMALL_FEATURE_PIXEL_THRESHOLD, sizeof(SMALL_FEATURE_PIXEL_THRESHOLD));
+	add(&LOD_PIXEL_ERROR_THRESHOLD, sizeof(LOD_PIXEL_ERROR_THRESHOLD));
+	add(&DRAW_RANGE_MERGE_GAP, sizeof(DRAW_RANGE_MERGE_GAP));
+	return hash;
+}
+
+uint32_t Object::visibleSetCacheSignature() const {
+	uint32_t pvs = _pvs.hash();
+	return hashBytes(_layoutSettings, &pvs, sizeof(pvs));
+}
+
+void Object::drawProxies() {
+	if(!_lodVao)
+		return;
+	if(_lodQueryActive) {
+		GLuint available = GL_FALSE;
+		glGetQueryObjectuiv(_lodQueryIDs[1], GL_QUERY_RESULT_AVAILABLE, &available);
+		if(available) {
+			GLuint64 start, end;
+			glGetQueryObjectui64v(_lodQueryIDs[0], GL_QUERY_RESULT, &start);
+			glGetQueryObjectui64v(_lodQueryIDs[1], GL_QUERY_RESULT, &end);
+			_lodDrawTime = double(end-start)/1000/1000;
+			_lodQueryActive = false;
+		}
+	}
+	if(_visibleProxyRanges.empty()) {
+		if(!_lodQueryActive)
+			_lodDrawTime = 0;
+		return;
+	}
+
+	bool doQuery = !_lodQueryActive;
+	if(doQuery)
+		glQueryCounter(_lodQueryIDs[0], GL_TIMESTAMP);
+	glBindVertexArray(_lodVao);
+	unsigned triangleCount = drawRanges(_visibleProxyRanges, _lodIndexLayout);
+	_renderedTriangleCount += triangleCount;
+	FC_LOD_TRIANGLE_COUNT += triangleCount;
+	glBindVertexArray(_vao);
+	if(doQuery) {
+		glQueryCounter(_lodQueryIDs[1], GL_TIMESTAMP);
+		_lodQueryActive = true;
+	}
+}
+
+unsigned Object::drawRanges(const std::vector<NodePrimitives>& ranges, const IndexBufferLayout& indexLayout) {
+	unsigned triangleCount = 0;
+	if(indexLayout.materialCount > 1) {
+		// state sorting, the draws of each material are consecutive and keep the order of the ranges
+		_sortedCommands.clear();
+		for(const NodePrimitives& r: ranges) {
+			indexLayout.splitRange(r, [&](unsigned first, unsigned count, const PrimitiveVertexRange& vr) {
+					_sortedCommands.push_back({count*3, 1, first*3, vr.baseVertex, vr.material});
+					});
+			triangleCount += r.count;
+		}
+		std::stable_sort(_sortedCommands.begin(), _sortedCommands.end(), [](const DrawElementsIndirectCommand& a, const DrawElementsIndirectCommand& b) {
+				return a.baseInstance < b.baseInstance;
+				});
+		if(_sortedCommands.empty())
+			return 0;
+		if(MULTI_DRAW_INDIRECT_ENABLED) {
+			PersistentRingBuffer::Allocation a = frameUploadBuffer().allocate(_sortedCommands.size()*sizeof(DrawElementsIndirectCommand), sizeof(GLuint));
+			std::copy(_sortedCommands.begin(), _sortedCommands.end(), static_cast<DrawElementsIndirectCommand*>(a.data));
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, a.buffer);
+			glMultiDrawElementsIndirect(GL_TRIANGLES, indexLayout.type, BUFFER_OFFSET(a.offset), _sortedCommands.size(), 0);
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+			++FC_DRAW_CALL_COUNT;
+		}
+		else {
+			for(const DrawElementsIndirectCommand& c : _sortedCommands)
+				glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, c.count, indexLayout.type,
+						BUFFER_OFFSET(indexLayout.indexSize()*c.firstIndex), 1, c.baseVertex, c.baseInstance);
+			FC_DRAW_CALL_COUNT += _sortedCommands.size();
+		}
+	}
+	else if(MULTI_DRAW_INDIRECT_ENABLED) {
+		if(ranges.empty())
+			return 0;
+		// the commands are written directly into the mapped memory, a range is split into one command per vertex range
+		unsigned maxCommandCount = 0;
+		for(const NodePrimitives& r: ranges)
+			maxCommandCount += indexLayout.vertexRanges.size() == 1 ? 1 : std::min<size_t>(r.count, indexLayout.vertexRanges.size());
+		PersistentRingBuffer::Allocation a = frameUploadBuffer().allocate(maxCommandCount*sizeof(DrawElementsIndirectCommand), sizeof(GLuint));
+		DrawElementsIndirectCommand* commands = static_cast<DrawElementsIndirectCommand*>(a.data);
+		unsigned commandCount = 0;
+		for(const NodePrimitives& r: ranges) {
+			commandCount += indexLayout.writeCommands(r, commands+commandCount);
+			triangleCount += r.count;
+		}
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, a.buffer);
+		glMultiDrawElementsIndirect(GL_TRIANGLES, indexLayout.type, BUFFER_OFFSET(a.offset), commandCount, 0);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		++FC_DRAW_CALL_COUNT;
+	}
+	else {
+		for(const NodePrimitives& r: ranges) {
+			FC_DRAW_CALL_COUNT += indexLayout.drawRange(r);
+			triangleCount += r.count;
+		}
+	}
+	return triangleCount;
+}
+
+unsigned Object::drawRangesCullingTriangles(const std::vector<NodePrimitives>& ranges, const Frustum& frustum) {
+	auto start = std::chrono::steady_clock::now();
+	const std::vector<NodePrimitives>& nodeRanges = _bvh.getNodePrimitiveRanges();
+	// the ranges are split by the leaves, the small and the contained leaves are drawn as they are
+	_unculledRanges.clear();
+	_triangleCulledRanges.clear();
+	AAboxInPlanesTester leafTester(frustum.planes);
+	unsigned maxTriangleCount = 0;
+	for(const NodePrimitives& r : ranges) {
+		auto it = std::upper_bound(_leafNodes.begin(), _leafNodes.end(), r.first, [&](unsigned p, unsigned n) {
+				return p < nodeRanges[n].first;
+				}) - 1;
+		for(unsigned first = r.first; first < r.first + r.count; ++it) {
+			const NodePrimitives& leaf = nodeRanges[*it];
+			NodePrimitives part{first, std::min(r.first + r.count, leaf.first + leaf.count) - first};
+			first += part.count;
+			if(leaf.count < TRIANGLE_CULLING_MIN_LEAF_SIZE) {
+				appendPrimitiveRange(_unculledRanges, part, 0);
+				continue;
+			}
+			// the ranges may come from a cache culled against another frustum
+			ContainmentType c = leafTester.boxInPlanes(_bvh.getNodeBounds(*it));
+			if(c == ContainmentType::Inside)
+				appendPrimitiveRange(_unculledRanges, part, 0);
+			else if(c == ContainmentType::Intersecting) {
+				_triangleCulledRanges.push_back(part);
+				maxTriangleCount += part.count;
+			}
+			else
+				FC_TRIANGLE_CULLED_TRIANGLE_COUNT += part.count;
+		}
+	}
+
+	// the streamed primitives are numbered from the start of the buffer, so the allocation is aligned to whole triangles
+	unsigned triangleSize = 3*_indexLayout.indexSize();
+	PersistentRingBuffer::Allocation a = frameUploadBuffer().allocate((maxTriangleCount+1)*triangleSize, _indexLayout.indexSize());
+	unsigned firstStreamed = (a.offset + triangleSize-1)/triangleSize;
+	char* streamed = static_cast<char*>(a.data) + (firstStreamed*triangleSize - a.offset);
+	const char* indexData = _leafIndexData.empty() ? reinterpret_cast<const char*>(_indices.data()) : _leafIndexData.data();
+	_streamedIndexLayout.vertexRanges.clear();
+	unsigned streamedCount = 0;
+	for(const NodePrimitives& r : _triangleCulledRanges)
+		_indexLayout.splitRange(r, [&](unsigned first, unsigned count, const PrimitiveVertexRange& vr) {
+				if(_streamedIndexLayout.vertexRanges.empty()
+						|| _streamedIndexLayout.vertexRanges.back().baseVertex != vr.baseVertex
+						|| _streamedIndexLayout.vertexRanges.back().material != vr.material)
+					_streamedIndexLayout.vertexRanges.push_back({firstStreamed + streamedCount, vr.baseVertex, vr.vertexCount, vr.material});
+				for(unsigned p = first; p < first + count; ++p) {
+					const glm::vec3& v0 = _positions[_indices[p*3+0]];
+					const glm::vec3& v1 = _positions[_indices[p*3+1]];
+					const glm::vec3& v2 = _positions[_indices[p*3+2]];
+					bool culled = false;
+					for(const Plane& pl : frustum.planes)
+						if(glm::dot(glm::vec4(v0, 1), pl) < 0 && glm::dot(glm::vec4(v1, 1), pl) < 0 && glm::dot(glm::vec4(v2, 1), pl) < 0) {
+							culled = true;
+							break;
+						}
+					if(!culled && BF_CULLING_ENABLED)
+						culled = glm::dot(glm::cross(v1-v0, v2-v0), frustum.viewPoint-v0) <= 0;
+					if(culled)
+						continue;
+					std::copy(indexData + p*triangleSize, indexData + (p+1)*triangleSize, streamed + streamedCount*triangleSize);
+					++streamedCount;
+				}
+				});
+	FC_TRIANGLE_CULLED_TRIANGLE_COUNT += maxTriangleCount - streamedCount;
+	float cullingTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now()-start).count()/1000.f;
+	FC_TRIANGLE_CULLING_TIME += cullingTime;
+	FC_TRAVERSE_TIME += cullingTime;
+
+	unsigned triangleCount = drawRanges(_unculledRanges, _indexLayout);
+	if(streamedCount > 0) {
+		// the element buffer binding is part of the VAO state
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, a.buffer);
+		triangleCount += drawRanges({{firstStreamed, streamedCount}}, _streamedIndexLayout);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _indexBuffer);
+	}
+	return triangleCount;
+}
+
+const std::vector<NodePrimitives>& Object::visiblePrimitiveRanges(const Frustum& frustum, OcclusionBuffer* occlusionBuffer, std::vector<NodePrimitives>& proxyRanges) {
+	const std::vector<unsigned>* pvsCellLeaves = PVS_ENABLED ? _pvs.cellLeaves(frustum.viewPoint) : nullptr;
+	if(pvsCellLeaves != _pvsCellLeaves) {
+		_bvh.restrictToLeaves(pvsCellLeaves);
+		_pvsCellLeaves = pvsCellLeaves;
+	}
+	unsigned maxMergeGap = DRAW_RANGE_COALESCING_ENABLED ? DRAW_RANGE_MERGE_GAP : NO_RANGE_MERGING;
+	proxyRanges.clear();
+	if(!occlusionBuffer)
+		return _bvh.primitiveRangesInFrustum(frustum, maxMergeGap, &proxyRanges);
+
+	static std::vector<NodePrimitives> visibleRanges;
+	visibleRanges.clear();
+	std::vector<unsigned> proxyNodes;
+	const std::vector<unsigned>& nodesInFrustum = _bvh.nodesInFrustum(frustum, &proxyNodes);
+	auto start = std::chrono::steady_clock::now();
+	occlusionBuffer->setTransform(frustum.modelViewProjection);
+	std::vector<unsigned> occluderNodes = nodesInFrustum;
+	occluderNodes.insert(occluderNodes.end(), proxyNodes.begin(), proxyNodes.end());
+	rasterizeOccluders(occluderNodes, frustum, *occlusionBuffer);
+	occlusionBuffer->updateHierarchy();
+	FC_OCCLUSION_CULLED_TRIANGLE_COUNT += _bvh.visibleSubtreeRanges(
+			nodesInFrustum,
+			[&](unsigned nodeI){ return occlusionBuffer->boxVisible(_bvh.getNodeBounds(nodeI)); },
+			visibleRanges,
+			maxMergeGap);
+	for(unsigned n : proxyNodes) {
+		const NodePrimitives& proxy = _bvh.getNodeProxies()[n].primitives;
+		if(occlusionBuffer->boxVisible(_bvh.getNodeBounds(n)))
+			appendPrimitiveRange(proxyRanges, proxy, maxMergeGap);
+		else
+			FC_OCCLUSION_CULLED_TRIANGLE_COUNT += proxy.count;
+	}
+	FC_OCCLUSION_TIME += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now()-start).count()/1000.f;
+	return visibleRanges;
+}
+
+void Object::rasterizeOccluders(const std::vector<unsigned>& nodes, const Frustum& frustum, OcclusionBuffer& occlusionBuffer) {
+	const std::vector<NodeOccluders>& nodeOccluders = _bvh.getNodeOccluders();
+	const std::vector<unsigned>& occluderPrimitives = _bvh.getOccluderPrimitives();
+	// projected area of the occluders, ignoring their orientation
+	std::vector<std::pair<float, unsigned>> nodesByArea;
+	nodesByArea.reserve(nodes.size());
+	for(unsigned n : nodes) {
+		float distanceSq = std::max(glm::dot(_bvh.getNodeBounds(n).centroid()-frustum.viewPoint, _bvh.getNodeBounds(n).centroid()-frustum.viewPoint), 1e-6f);
+		nodesByArea.push_back({nodeOccluders[n].area/distanceSq, n});
+	}
+	std::sort(nodesByArea.begin(), nodesByArea.end(), std::greater<std::pair<float, unsigned>>());
+
+	for(const auto& na : nodesByArea) {
+		if(occlusionBuffer.getRasterizedTriangleCount() >= OCCLUDER_TRIANGLE_BUDGET)
+			break;
+		const NodeOccluders& occluders = nodeOccluders[na.second];
+		unsigned count = std::min(occluders.count, OCCLUDER_TRIANGLE_BUDGET - occlusionBuffer.getRasterizedTriangleCount());
+		for(unsigned i = occluders.first; i < occluders.first + count; ++i) {
+			unsigned p = occluderPrimitives[i];
+			occlusionBuffer.rasterizeTriangle(
+					_positions[_indices[p*3+0]],
+					_positions[_indices[p*3+1]],
+					_positions[_indices[p*3+2]]);
+		}
+		FC_OCCLUDER_TRIANGLE_COUNT += count;
 	}
 }
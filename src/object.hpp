@@ -3,6 +3,14 @@
 #include <string>
 #include "types.hpp"
 #include "bvh.hpp"
+#include "occlusion.hpp"
+#include "chc.hpp"
+#include "gpuCulling.hpp"
+#include "pvs.hpp"
+#include "visibleSetCache.hpp"
+#include "indexBufferLayout.hpp"
+#include "workerThread.hpp"
+#include "globals.hpp"
 
 class Object {
 	friend class Scene;
@@ -29,7 +37,12 @@ class Object {
 		 */
 		double getDrawTime() const;
 
-		/** Returns the number of triangles of this object that were sent for rendering in the last frame.
+		/** Returns the time in took for the GPU to draw the node proxies in milliseconds (included in getDrawTime).
+		 * It is measured using timestamp queries.
+		 */
+		double getLodDrawTime() const;
+
+		/** Returns the number of triangles of this object that were sent for rendering in the last frame (including proxies).
 		 */
 		unsigned getRenderedTriangleCount() const;
 
@@ -39,38 +52,154 @@ class Object {
 
 		glm::mat4 getTransform() const;
 
-		Material& getMaterial();
+		/** Returns the materials of the object, a draw passes the index of its material as the base instance.
+		 */
+		const std::vector<Material>& getMaterials() const;
 
 		/** Returns untransformed axis-aligned bounding box.
 		 */
 		const AABB& getAABB() const;
 
+		/** Computes potentially visible sets for the view cells along the route and saves them to the file.
+		 * The route points and the cell size are in world space.
+		 */
+		bool buildPVS(const std::vector<glm::vec3>& routePoints, float cellSize, unsigned raysPerCell, const std::string& fileName);
+
+		/** Loads a PVS built by buildPVS, it must be built with the same max. primitives in leaf.
+		 * The PVS is used by frustum culling while PVS_ENABLED is set.
+		 */
+		bool loadPVS(const std::string& fileName);
+
+		/** Sets the memory budget of the visible set cache (see VISIBLE_SET_CACHE_ENABLED).
+		 */
+		void setVisibleSetCacheBudget(size_t bytes);
+
+		bool saveVisibleSetCache(const std::string& fileName) const;
+		bool loadVisibleSetCache(const std::string& fileName);
+
 	private:
 		GLuint _queryID;
 		GLuint _vao;
 		GLuint _indexBuffer;
 		GLuint _vertexBuffer;
 		GLuint _vertexCount;
+		GLuint _lodQueryIDs[2]; /// timestamps before and after drawing the proxies
+		GLuint _lodVao; /// proxies of the BVH nodes (0 if not built)
+		GLuint _lodIndexBuffer;
+		GLuint _lodVertexBuffer;
+		GLuint _materialIDBuffer; /// material indices read by the instanced vertex attribute 2 (the i-th element is i)
+		IndexBufferLayout _indexLayout;
+		IndexBufferLayout _lodIndexLayout;
+		bool _compressedVertices; /// the vertex buffers contain CompressedVertex
+		glm::vec3 _positionOffset; /// the vertex shader decodes the position as offset + position*scale
+		glm::vec3 _positionScale;
 		GLuint _triangleCount;
 		glm::mat4 _transform;
-		Material _material;
+		std::vector<Material> _materials;
 		double _drawTime;
+		double _lodDrawTime;
+		bool _lodQueryActive;
 		unsigned _renderedTriangleCount;
 		bool _queryActive;
 		AABB _aabb; /// used for frustum culling
 		BVH _bvh;
 		glm::vec3 _prevFrustumCenter;
-		std::vector<unsigned> _visibleNodes; /// from last frame - caching used if the view did not change
+		uint32_t _prevCullingSettings; /// the culling settings of the ranges reused by the camera coherency
+		bool _guardBandValid;
+		std::vector<Plane> _guardBandPlanes; /// the visible ranges were culled against these planes
+		glm::vec3 _guardBandViewPoint; /// from this view point
+		uint32_t _guardBandSettings; /// and with these culling settings
+		VisibleSetCache _visibleSetCache;
+		uint32_t _layoutSettings; /// hash of the load time settings which determine the primitive order and the index buffer layout
+		std::vector<NodePrimitives> _visibleRanges; /// from last frame - caching used if the view did not change
+		std::vector<NodePrimitives> _visibleProxyRanges; /// ranges of the LOD index buffer drawn instead of subtrees
+		std::vector<glm::vec3> _positions; /// CPU copy of vertex positions used for software occlusion culling
+		std::vector<unsigned> _indices; /// CPU copy of the index buffer (in BVH primitive order)
+		std::vector<char> _leafIndexData; /// CPU copy of the leaf-local index buffer (only with leaf vertex ranges, _indices keeps the global indices)
+		std::vector<unsigned> _leafNodes; /// non-empty leaves sorted by their first primitive
+		std::vector<NodePrimitives> _unculledRanges; /// the visible ranges whose triangles are not culled one by one
+		std::vector<NodePrimitives> _triangleCulledRanges;
+		IndexBufferLayout _streamedIndexLayout; /// the triangles which survived triangle culling in frameUploadBuffer
+		std::vector<DrawElementsIndirectCommand> _sortedCommands; /// the draws of objects with several materials, sorted by material
+		CHCOcclusionCuller _chc;
+		GPUFrustumCuller _gpuCuller;
+		PVS _pvs;
+		const std::vector<unsigned>* _pvsCellLeaves; /// the leaves the BVH traversal is currently restricted to
+		bool _speculativeCullingActive; /// the next frustum is being culled by speculativeCullingWorker
+		bool _speculativeRangesValid;
+		Frustum _speculativeFrustum;
+		std::vector<NodePrimitives> _speculativeRanges; /// culling result for _speculativeFrustum
+		std::vector<NodePrimitives> _speculativeProxyRanges;
+		TraversalCounters _speculativeCounters; /// of the worker, added to the frame counters if the result is used
+		float _speculativeTraverseTime; // [ms]
 
 		/** Optionally does the timer query and calls doDrawing.
-		 * FrustumCenter, lookDir, up are all in model space.
+		 * The frustum is in model space.
+		 * If the occlusion buffer is given, the object is culled by the already rasterized occluders and rasterizes its own occluders.
+		 * If the predicted frustum of the next frame is given, it is culled speculatively (see SPECULATIVE_CULLING_ENABLED).
 		 */
-		virtual void draw(const std::vector<Plane>& frustumPlanes, const glm::vec3& frustumCenter, const glm::vec3& lookDir, const glm::vec3& up, bool doTimerQuery = false);
+		virtual void draw(const Frustum& frustum, OcclusionBuffer* occlusionBuffer, const Frustum* nextFrustum, bool doTimerQuery = false);
 
 		/** Actually draws the primitives.
-		 * FrustumCenter, lookDir, up are all in model space.
+		 * The frustum is in model space.
+		 * With GPU occlusion culling the BVH traversal is interleaved with the drawing and the occlusion buffer is not used.
+		 * With GPU frustum culling the BVH is traversed by a compute shader and the CPU only issues one indirect draw.
+		 * With speculative culling the next frustum is culled on a worker thread while the draw calls are issued.
+		 * The result is used in the next frame if the frustum turns out to be the same, otherwise the culling is done synchronously.
+		 * With the visible set cache the culling results of already seen camera poses are reused.
+		 * With guard band caching the visible ranges of an enlarged frustum are reused until the frustum leaves it.
+		 * Speculative culling, the visible set cache and guard band caching are not used together with occlusion culling, which depends on the current frame.
+		 */
+		void doDrawing(const Frustum& frustum, OcclusionBuffer* occlusionBuffer, const Frustum* nextFrustum);
+
+		/** Returns primitive ranges which passed frustum culling and (if the occlusion buffer is given) occlusion culling.
+		 * The visible proxy ranges (see LOD_ENABLED) replace proxyRanges.
+		 * The referenced vector will be reused in next call.
+		 */
+		const std::vector<NodePrimitives>& visiblePrimitiveRanges(const Frustum& frustum, OcclusionBuffer* occlusionBuffer, std::vector<NodePrimitives>& proxyRanges);
+
+		/** Returns true if the culling result depends on the view point and not only on the frustum planes
+		 * (normal cone, small feature and LOD tests, or the view point moved into another PVS cell).
+		 */
+		bool viewPointDependentCulling(const Frustum& frustum) const;
+
+		/** Returns a hash of the settings which change the culling result.
+		 */
+		uint32_t cullingSettings() const;
+
+		/** Returns a hash of the primitive order, the index buffer layout and the loaded PVS,
+		 * a saved visible set cache is only valid for an object with the same signature.
+		 */
+		uint32_t visibleSetCacheSignature() const;
+
+		/** Uploads the vertices into the bound GL_ARRAY_BUFFER and sets the vertex attributes of the bound VAO.
+		 * The vertices are compressed if _compressedVertices is set.
+		 * Returns the max. angle between a normal and its decoded value [rad] (0 if not compressed).
+		 */
+		float uploadVertices(const std::vector<Vertex>& vertices);
+
+		/** Draws the primitive ranges from the index buffer of the bound VAO and returns the number of triangles drawn.
+		 * With MULTI_DRAW_INDIRECT_ENABLED all ranges are submitted by a single glMultiDrawElementsIndirect (the commands are written to frameUploadBuffer),
+		 * otherwise by one glDrawRangeElementsBaseVertex per range. With leaf vertex ranges a range is split into one draw per leaf.
+		 * With several materials the ranges are split by material and the draws are sorted by material.
+		 */
+		unsigned drawRanges(const std::vector<NodePrimitives>& ranges, const IndexBufferLayout& indexLayout);
+
+		/** Draws the primitive ranges like drawRanges, but the triangles of the leaves with at least TRIANGLE_CULLING_MIN_LEAF_SIZE primitives
+		 * which intersect the frustum are culled one by one (see TRIANGLE_CULLING_ENABLED).
+		 * Their surviving indices are copied into a streaming index buffer in frameUploadBuffer, which is drawn instead of the leaf ranges.
+		 * The frustum is in model space. Returns the number of triangles drawn.
+		 */
+		unsigned drawRangesCullingTriangles(const std::vector<NodePrimitives>& ranges, const Frustum& frustum);
+
+		/** Draws the visible proxies from the LOD buffers and measures the time it took.
+		 */
+		void drawProxies();
+
+		/** Rasterizes the preselected occluders of the nodes into the occlusion buffer.
+		 * Nodes with the largest projected occluder area go first, until OCCLUDER_TRIANGLE_BUDGET triangles are rasterized in the frame.
 		 */
-		void doDrawing(const std::vector<Plane>& frustumPlanes, const glm::vec3& frustumCenter, const glm::vec3& lookDir, const glm::vec3& up);
+		void rasterizeOccluders(const std::vector<unsigned>& nodes, const Frustum& frustum, OcclusionBuffer& occlusionBuffer);
 };
 
 #endif /* OBJECT_HPP_19_04_21_09_20_37 */
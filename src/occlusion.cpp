@@ -0,0 +1,177 @@
+#include <algorithm>
+#include <cmath>
+#if defined(__SSE2__) || defined(_M_X64)
+#define OCCLUSION_USE_SSE
+#include <emmintrin.h>
+#endif
+#include "occlusion.hpp"
+
+OcclusionBuffer::OcclusionBuffer(unsigned width, unsigned height):
+	_width{(width+TILE_SIZE-1)/TILE_SIZE*TILE_SIZE},
+	_height{(height+TILE_SIZE-1)/TILE_SIZE*TILE_SIZE},
+	_tilesX{_width/TILE_SIZE},
+	_tilesY{_height/TILE_SIZE},
+	_rasterizedTriangleCount{0},
+	_mvp{1}
+{
+	_depth.resize(_width*_height);
+	_tileMaxDepth.resize(_tilesX*_tilesY);
+	clear();
+}
+
+void OcclusionBuffer::clear() {
+	std::fill(_depth.begin(), _depth.end(), 1.f);
+	std::fill(_tileMaxDepth.begin(), _tileMaxDepth.end(), 1.f);
+	_rasterizedTriangleCount = 0;
+}
+
+void OcclusionBuffer::setTransform(const glm::mat4& modelViewProjection) {
+	_mvp = modelViewProjection;
+}
+
+void OcclusionBuffer::rasterizeTriangle(const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2) {
+	++_rasterizedTriangleCount;
+	glm::vec3 s[3];
+	const glm::vec3* v[3] = {&v0, &v1, &v2};
+	float z = -1;
+	for(unsigned i = 0; i < 3; ++i) {
+		glm::vec4 c = _mvp*glm::vec4(*v[i], 1);
+		if(c.w <= 0 || c.z < -c.w) // (partially) in front of the near plane
+			return;
+		s[i] = glm::vec3(
+				(c.x/c.w*0.5f + 0.5f)*_width,
+				(c.y/c.w*0.5f + 0.5f)*_height,
+				c.z/c.w);
+		z = std::max(z, s[i].z);
+	}
+	float area = (s[1].x-s[0].x)*(s[2].y-s[0].y) - (s[1].y-s[0].y)*(s[2].x-s[0].x);
+	if(area == 0)
+		return;
+	if(area < 0) // both faces occlude
+		std::swap(s[1], s[2]);
+
+	int minX = std::max(0, int(std::floor(std::min({s[0].x, s[1].x, s[2].x}))));
+	int maxX = std::min(int(_width)-1, int(std::floor(std::max({s[0].x, s[1].x, s[2].x}))));
+	int minY = std::max(0, int(std::floor(std::min({s[0].y, s[1].y, s[2].y}))));
+	int maxY = std::min(int(_height)-1, int(std::floor(std::max({s[0].y, s[1].y, s[2].y}))));
+	if(minX > maxX || minY > maxY)
+		return;
+	minX &= ~3; // the rows are processed by 4 pixels, the width is a multiple of 4
+
+	// edge functions e(x,y) = a*x + b*y + c, positive inside
+	float a[3], b[3], c[3];
+	for(unsigned i = 0; i < 3; ++i) {
+		const glm::vec3& p = s[i];
+		const glm::vec3& q = s[(i+1)%3];
+		a[i] = -(q.y-p.y);
+		b[i] = q.x-p.x;
+		c[i] = -a[i]*p.x - b[i]*p.y;
+		// evaluated at the pixel centre, the edge function is shifted to its value in the pixel corner farthest inside,
+		// so only pixels covered completely are written and gaps narrower than a pixel stay open
+		c[i] -= 0.5f*(std::abs(a[i]) + std::abs(b[i]));
+	}
+
+#ifdef OCCLUSION_USE_SSE
+	const __m128 pixelOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 triZ = _mm_set1_ps(z);
+	__m128 a4[3], stepX[3];
+	for(unsigned i = 0; i < 3; ++i) {
+		a4[i] = _mm_set1_ps(a[i]);
+		stepX[i] = _mm_set1_ps(4*a[i]);
+	}
+	for(int y = minY; y <= maxY; ++y) {
+		float py = y + 0.5f;
+		__m128 px = _mm_add_ps(_mm_set1_ps(float(minX)), pixelOffsets);
+		__m128 e[3];
+		for(unsigned i = 0; i < 3; ++i)
+			e[i] = _mm_add_ps(_mm_mul_ps(a4[i], px), _mm_set1_ps(b[i]*py + c[i]));
+		float* row = &_depth[y*_width];
+		for(int x = minX; x <= maxX; x += 4) {
+			__m128 inside = _mm_and_ps(_mm_and_ps(
+						_mm_cmpge_ps(e[0], zero),
+						_mm_cmpge_ps(e[1], zero)),
+					_mm_cmpge_ps(e[2], zero));
+			if(_mm_movemask_ps(inside)) {
+				__m128 d = _mm_loadu_ps(row + x);
+				d = _mm_or_ps(_mm_and_ps(inside, _mm_min_ps(d, triZ)), _mm_andnot_ps(inside, d));
+				_mm_storeu_ps(row + x, d);
+			}
+			for(unsigned i = 0; i < 3; ++i)
+				e[i] = _mm_add_ps(e[i], stepX[i]);
+		}
+	}
+#else
+	for(int y = minY; y <= maxY; ++y) {
+		float py = y + 0.5f;
+		float* row = &_depth[y*_width];
+		for(int x = minX; x <= maxX; ++x) {
+			float px = x + 0.5f;
+			if(a[0]*px + b[0]*py + c[0] >= 0 &&
+					a[1]*px + b[1]*py + c[1] >= 0 &&
+					a[2]*px + b[2]*py + c[2] >= 0)
+				row[x] = std::min(row[x], z);
+		}
+	}
+#endif
+}
+
+void OcclusionBuffer::updateHierarchy() {
+	for(unsigned ty = 0; ty < _tilesY; ++ty)
+		for(unsigned tx = 0; tx < _tilesX; ++tx) {
+			float maxDepth = -1;
+			for(unsigned y = ty*TILE_SIZE; y < (ty+1)*TILE_SIZE; ++y) {
+				const float* row = &_depth[y*_width + tx*TILE_SIZE];
+				maxDepth = std::max(maxDepth, *std::max_element(row, row + TILE_SIZE));
+			}
+			_tileMaxDepth[ty*_tilesX + tx] = maxDepth;
+		}
+}
+
+bool OcclusionBuffer::boxVisible(const AABB& box) const {
+	glm::vec2 screenMin(std::numeric_limits<float>::max());
+	glm::vec2 screenMax(std::numeric_limits<float>::lowest());
+	float minZ = 1;
+	for(unsigned i = 0; i < 8; ++i) {
+		glm::vec4 c = _mvp*glm::vec4(box[AABB::VertexIndex(i)], 1);
+		if(c.w <= 0 || c.z < -c.w) // the box crosses the near plane
+			return true;
+		glm::vec2 s(
+				(c.x/c.w*0.5f + 0.5f)*_width,
+				(c.y/c.w*0.5f + 0.5f)*_height);
+		screenMin = glm::min(screenMin, s);
+		screenMax = glm::max(screenMax, s);
+		minZ = std::min(minZ, c.z/c.w);
+	}
+	int minX = std::max(0, int(std::floor(screenMin.x)));
+	int maxX = std::min(int(_width)-1, int(std::floor(screenMax.x)));
+	int minY = std::max(0, int(std::floor(screenMin.y)));
+	int maxY = std::min(int(_height)-1, int(std::floor(screenMax.y)));
+	if(minX > maxX || minY > maxY) // off screen - leave the decision to the frustum test
+		return true;
+
+	for(int ty = minY/TILE_SIZE; ty <= maxY/int(TILE_SIZE); ++ty)
+		for(int tx = minX/TILE_SIZE; tx <= maxX/int(TILE_SIZE); ++tx) {
+			if(_tileMaxDepth[ty*_tilesX + tx] < minZ) // all pixels of the tile hide the box
+				continue;
+			int y0 = std::max(minY, ty*int(TILE_SIZE)), y1 = std::min(maxY, (ty+1)*int(TILE_SIZE)-1);
+			int x0 = std::max(minX, tx*int(TILE_SIZE)), x1 = std::min(maxX, (tx+1)*int(TILE_SIZE)-1);
+			for(int y = y0; y <= y1; ++y)
+				for(int x = x0; x <= x1; ++x)
+					if(_depth[y*_width + x] >= minZ)
+						return true;
+		}
+	return false;
+}
+
+unsigned OcclusionBuffer::getRasterizedTriangleCount() const {
+	return _rasterizedTriangleCount;
+}
+
+unsigned OcclusionBuffer::getWidth() const {
+	return _width;
+}
+
+unsigned OcclusionBuffer::getHeight() const {
+	return _height;
+}
@@ -0,0 +1,64 @@
+/** @file */
+#ifndef OCCLUSION_HPP_26_10_19_14_05_12
+#define OCCLUSION_HPP_26_10_19_14_05_12
+#include <vector>
+#include "types.hpp"
+
+/** Low resolution software depth buffer used for CPU occlusion culling.
+ * It does not use the GPU at all, but the culling stage is driven by Object, so it is only run inside the application
+ * (a headless benchmark mode is not implemented yet).
+ *
+ * Occluder triangles are rasterized conservatively - only the pixels covered completely by a triangle are written
+ * and they get the depth of its farthest vertex, so a pixel never hides more than the occluders really cover.
+ * No depth interpolation is needed and 4 pixels are processed at once using SSE.
+ * The buffer also keeps the farthest depth of each tile, so that most occludee tests do not have to visit individual pixels.
+ * Depth is the normalized device z coordinate.
+ */
+class OcclusionBuffer {
+	public:
+		static const unsigned TILE_SIZE = 8;
+
+		/** The width and height are rounded up to a multiple of TILE_SIZE.
+		 */
+		OcclusionBuffer(unsigned width, unsigned height);
+
+		/** Resets all pixels to the far plane depth.
+		 */
+		void clear();
+
+		/** Sets the model-view-projection matrix used for the following occluders and occludees.
+		 */
+		void setTransform(const glm::mat4& modelViewProjection);
+
+		/** Rasterizes an occluder triangle given in model space.
+		 * Triangles which are not completely behind the near plane are skipped.
+		 */
+		void rasterizeTriangle(const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2);
+
+		/** Updates the per-tile depths.
+		 * Must be called after the occluders are rasterized and before the occludees are tested.
+		 */
+		void updateHierarchy();
+
+		/** Returns false if the box (in model space) is completely hidden behind the rasterized occluders.
+		 */
+		bool boxVisible(const AABB& box) const;
+
+		/** Returns the number of occluder triangles passed to rasterizeTriangle since the last clear.
+		 */
+		unsigned getRasterizedTriangleCount() const;
+
+		unsigned getWidth() const;
+		unsigned getHeight() const;
+
+	private:
+		unsigned _width;
+		unsigned _height;
+		unsigned _tilesX;
+		unsigned _tilesY;
+		unsigned _rasterizedTriangleCount;
+		glm::mat4 _mvp;
+		std::vector<float> _depth;
+		std::vector<float> _tileMaxDepth;
+};
+#endif /* OCCLUSION_HPP_26_10_19_14_05_12 */
@@ -0,0 +1,221 @@
+#include <atomic>
+#include <cmath>
+#include <fstream>
+#include <random>
+#include <thread>
+#include <glm/gtc/constants.hpp>
+#include "pvs.hpp"
+
+static const unsigned CELL_COORD_BITS = 21;
+
+/** Möller-Trumbore ray-triangle intersection.
+ * Returns the ray parameter of the intersection or infinity. Both faces are hit.
+ */
+static float rayTriangleDistance(const glm::vec3& origin, const glm::vec3& direction, const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2) {
+	const float inf = std::numeric_limits<float>::infinity();
+	glm::vec3 e1 = v1-v0;
+	glm::vec3 e2 = v2-v0;
+	glm::vec3 p = glm::cross(direction, e2);
+	float det = glm::dot(e1, p);
+	if(std::abs(det) < 1e-12f)
+		return inf;
+	float invDet = 1/det;
+	glm::vec3 s = origin-v0;
+	float u = glm::dot(s, p)*invDet;
+	if(u < 0 || u > 1)
+		return inf;
+	glm::vec3 q = glm::cross(s, e1);
+	float v = glm::dot(direction, q)*invDet;
+	if(v < 0 || u+v > 1)
+		return inf;
+	float t = glm::dot(e2, q)*invDet;
+	return t > 0 ? t : inf;
+}
+
+static void writeVarint(std::ostream& os, uint32_t v) {
+	while(v >= 0x80) {
+		os.put(char((v & 0x7f) | 0x80));
+		v >>= 7;
+	}
+	os.put(char(v));
+}
+
+static bool readVarint(std::istream& is, uint32_t& v) {
+	v = 0;
+	for(unsigned shift = 0; shift < 35; shift += 7) {
+		int c = is.get();
+		if(c == EOF)
+			return false;
+		v |= uint32_t(c & 0x7f) << shift;
+		if(!(c & 0x80))
+			return true;
+	}
+	return false;
+}
+
+template<typename T>
+static void writeRaw(std::ostream& os, const T& v) {
+	os.write(reinterpret_cast<const char*>(&v), sizeof(T));
+}
+
+template<typename T>
+static bool readRaw(std::istream& is, T& v) {
+	return bool(is.read(reinterpret_cast<char*>(&v), sizeof(T)));
+}
+
+PVS::PVS():
+	_cellSize{1},
+	_nodeCount{0}
+{}
+
+void PVS::build(
+		const BVH& bvh,
+		const std::vector<glm::vec3>& positions,
+		const std::vector<unsigned>& indices,
+		const std::vector<glm::vec3>& routePoints,
+		float cellSize,
+		unsigned raysPerCell)
+{
+	_cellSize = cellSize;
+	_nodeCount = bvh.getNodeCount();
+	_cells.clear();
+	for(const glm::vec3& p : routePoints)
+		_cells[cellKey(p)];
+
+	std::vector<std::pair<const uint64_t, std::vector<unsigned>>*> cells;
+	for(auto& c : _cells)
+		cells.push_back(&c);
+	std::atomic<unsigned> nextCell{0};
+	auto processCells = [&]() {
+		std::vector<bool> leafVisible;
+		for(unsigned i; (i = nextCell++) < cells.size();) {
+			uint64_t key = cells[i]->first;
+			glm::vec3 cellMin;
+			for(unsigned a = 0; a < 3; ++a)
+				cellMin[a] = (int((key >> (a*CELL_COORD_BITS)) & ((1u<<CELL_COORD_BITS)-1)) - int(1u<<(CELL_COORD_BITS-1)))*cellSize;
+
+			std::mt19937 rng(i); // the result does not depend on the thread count
+			std::uniform_real_distribution<float> uniform01(0, 1);
+			leafVisible.assign(_nodeCount, false);
+			for(unsigned r = 0; r < raysPerCell; ++r) {
+				glm::vec3 origin = cellMin + glm::vec3(uniform01(rng), uniform01(rng), uniform01(rng))*cellSize;
+				float z = 2*uniform01(rng)-1;
+				float phi = 2*glm::pi<float>()*uniform01(rng);
+				float sinTheta = std::sqrt(std::max(0.f, 1-z*z));
+				glm::vec3 direction(sinTheta*std::cos(phi), sinTheta*std::sin(phi), z);
+				unsigned leaf = bvh.closestHitLeaf(origin, direction, [&](unsigned p) {
+						return rayTriangleDistance(origin, direction,
+								positions[indices[p*3+0]],
+								positions[indices[p*3+1]],
+								positions[indices[p*3+2]]);
+						});
+				if(leaf != unsigned(-1))
+					leafVisible[leaf] = true;
+			}
+			for(unsigned n = 0; n < _nodeCount; ++n)
+				if(leafVisible[n])
+					cells[i]->second.push_back(n);
+		}
+	};
+	std::vector<std::thread> threads(std::max(1u, std::thread::hardware_concurrency()));
+	for(std::thread& t : threads)
+		t = std::thread(processCells);
+	for(std::thread& t : threads)
+		t.join();
+}
+
+bool PVS::save(const std::string& fileName) const {
+	std::ofstream of(fileName, std::ios::binary);
+	if(!of)
+		return false;
+	of.write("PVS1", 4);
+	writeRaw<uint32_t>(of, _nodeCount);
+	writeRaw<float>(of, _cellSize);
+	writeRaw<uint32_t>(of, _cells.size());
+	for(const auto& c : _cells) {
+		writeRaw<uint64_t>(of, c.first);
+		writeRaw<uint32_t>(of, c.second.size());
+		unsigned prev = 0;
+		for(unsigned leaf : c.second) {
+			writeVarint(of, leaf-prev);
+			prev = leaf;
+		}
+	}
+	return bool(of);
+}
+
+bool PVS::load(const std::string& fileName) {
+	std::ifstream ifile(fileName, std::ios::binary);
+	char magic[4];
+	uint32_t nodeCount, cellCount;
+	float cellSize;
+	if(!ifile.read(magic, 4) || std::string(magic, 4) != "PVS1"
+			|| !readRaw(ifile, nodeCount) || !readRaw(ifile, cellSize) || !readRaw(ifile, cellCount))
+		return false;
+	std::map<uint64_t, std::vector<unsigned>> cells;
+	for(unsigned i = 0; i < cellCount; ++i) {
+		uint64_t key;
+		uint32_t leafCount;
+		if(!readRaw(ifile, key) || !readRaw(ifile, leafCount))
+			return false;
+		std::vector<unsigned>& leaves = cells[key];
+		unsigned leaf = 0;
+		for(unsigned j = 0; j < leafCount; ++j) {
+			uint32_t delta;
+			if(!readVarint(ifile, delta))
+				return false;
+			leaf += delta;
+			if(leaf >= nodeCount)
+				return false;
+			leaves.push_back(leaf);
+		}
+	}
+	_nodeCount = nodeCount;
+	_cellSize = cellSize;
+	_cells = std::move(cells);
+	return true;
+}
+
+const std::vector<unsigned>* PVS::cellLeaves(const glm::vec3& point) const {
+	auto it = _cells.find(cellKey(point));
+	return it == _cells.end() ? nullptr : &it->second;
+}
+
+bool PVS::empty() const {
+	return _cells.empty();
+}
+
+uint32_t PVS::hash() const {
+	if(_cells.empty())
+		return 0;
+	// FNV-1a
+	uint32_t hash = 2166136261u;
+	auto add = [&](const void* data, size_t size) {
+		for(size_t i = 0; i < size; ++i) {
+			hash ^= static_cast<const uint8_t*>(data)[i];
+			hash *= 16777619u;
+		}
+	};
+	add(&_cellSize, sizeof(_cellSize));
+	for(const auto& c : _cells) {
+		uint32_t leafCount = c.second.size();
+		add(&c.first, sizeof(c.first));
+		add(&leafCount, sizeof(leafCount));
+		add(c.second.data(), c.second.size()*sizeof(unsigned));
+	}
+	return hash;
+}
+
+unsigned PVS::getNodeCount() const {
+	return _nodeCount;
+}
+
+uint64_t PVS::cellKey(const glm::vec3& point) const {
+	uint64_t key = 0;
+	for(unsigned a = 0; a < 3; ++a) {
+		int c = int(std::floor(point[a]/_cellSize)) + int(1u<<(CELL_COORD_BITS-1));
+		c = std::min(std::max(c, 0), int(1u<<CELL_COORD_BITS)-1);
+		key |= uint64_t(c) << (a*CELL_COORD_BITS);
+	}
+	return key;
+}
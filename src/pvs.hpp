@@ -0,0 +1,60 @@
+/** @file */
+#ifndef PVS_HPP_26_10_19_16_12_40
+#define PVS_HPP_26_10_19_16_12_40
+#include <map>
+#include <string>
+#include <vector>
+#include "bvh.hpp"
+
+/** Potentially visible sets of BVH leaves precomputed for view cells along a camera route.
+ * The space is divided into a uniform grid of cubic view cells, only the cells the route passes through are stored.
+ *
+ * The visibility is sampled by casting rays from random points of the cell in uniformly distributed directions,
+ * so small leaves which are not hit by any ray are missing from the set (the PVS is aggressive, not conservative).
+ * Everything is in the model space of the BVH.
+ */
+class PVS {
+	public:
+		PVS();
+
+		/** Computes the PVS of each cell containing a route point.
+		 * The route should be sampled densely enough not to skip any cell.
+		 * The positions and indices are the vertices and the index buffer in the BVH primitive order.
+		 * The cells are processed in parallel.
+		 */
+		void build(
+				const BVH& bvh,
+				const std::vector<glm::vec3>& positions,
+				const std::vector<unsigned>& indices,
+				const std::vector<glm::vec3>& routePoints,
+				float cellSize,
+				unsigned raysPerCell);
+
+		/** Binary file: "PVS1", node count, cell size, cell count,
+		 * then for each cell its key, leaf count and the sorted leaf indices delta-encoded as LEB128 varints.
+		 */
+		bool save(const std::string& fileName) const;
+		bool load(const std::string& fileName);
+
+		/** Returns the leaves potentially visible from the point or nullptr if the point lies outside all view cells.
+		 */
+		const std::vector<unsigned>* cellLeaves(const glm::vec3& point) const;
+
+		bool empty() const;
+
+		/** Returns a hash of the cell size and the cells, 0 for an empty PVS.
+		 */
+		uint32_t hash() const;
+
+		/** Returns the node count of the BVH the PVS was built for.
+		 */
+		unsigned getNodeCount() const;
+
+	private:
+		uint64_t cellKey(const glm::vec3& point) const;
+
+		float _cellSize;
+		unsigned _nodeCount;
+		std::map<uint64_t, std::vector<unsigned>> _cells;
+};
+#endif /* PVS_HPP_26_10_19_16_12_40 */
@@ -0,0 +1,107 @@
+#include <algorithm>
+#include <iostream>
+#include "ringBuffer.hpp"
+
+static const size_t FRAME_UPLOAD_REGION_SIZE = 1 << 20; // [B] initial size of one frame region
+static const GLuint64 FENCE_WAIT_TIMEOUT = 1000000000; // [ns]
+
+void waitForFence(GLsync fence) {
+	GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+	while(glClientWaitSync(fence, flags, FENCE_WAIT_TIMEOUT) == GL_TIMEOUT_EXPIRED)
+		flags = 0;
+}
+
+PersistentRingBuffer::PersistentRingBuffer(size_t regionSize):
+	_buffer{0},
+	_data{nullptr},
+	_regionSize{0},
+	_region{0},
+	_regionUsed{0},
+	_fences{}
+{
+	createBuffer(regionSize);
+}
+
+PersistentRingBuffer::~PersistentRingBuffer() {
+	for(GLsync& f : _fences)
+		if(f)
+			glDeleteSync(f);
+	for(RetiredBuffer& rb : _retiredBuffers) {
+		if(rb.fence)
+			glDeleteSync(rb.fence);
+		glDeleteBuffers(1, &rb.buffer);
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, _buffer);
+	glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	glDeleteBuffers(1, &_buffer);
+}
+
+void PersistentRingBuffer::beginFrame() {
+	_region = (_region+1)%FRAME_COUNT;
+	_regionUsed = 0;
+	GLsync& fence = _fences[_region];
+	if(fence) {
+		waitForFence(fence);
+		glDeleteSync(fence);
+		fence = nullptr;
+	}
+	for(auto it = _retiredBuffers.begin(); it != _retiredBuffers.end();) {
+		if(it->fence && glClientWaitSync(it->fence, 0, 0) != GL_TIMEOUT_EXPIRED) {
+			glDeleteSync(it->fence);
+			glDeleteBuffers(1, &it->buffer);
+			it = _retiredBuffers.erase(it);
+		}
+		else
+			++it;
+	}
+}
+
+void PersistentRingBuffer::endFrame() {
+	GLsync& fence = _fences[_region];
+	if(fence)
+		glDeleteSync(fence);
+	fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	for(RetiredBuffer& rb : _retiredBuffers)
+		if(!rb.fence)
+			rb.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+PersistentRingBuffer::Allocation PersistentRingBuffer::allocate(size_t size, size_t alignment) {
+	size_t offset = (_region*_regionSize + _regionUsed + alignment-1) & ~(alignment-1);
+	if(offset+size > (_region+1)*_regionSize) {
+		// the allocations of this frame made so far stay in the old buffer
+		_retiredBuffers.push_back({_buffer, nullptr});
+		glBindBuffer(GL_COPY_WRITE_BUFFER, _buffer);
+		glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		createBuffer(std::max(2*_regionSize, 2*(size+alignment)));
+		offset = (_region*_regionSize + alignment-1) & ~(alignment-1);
+	}
+	_regionUsed = offset+size - _region*_regionSize;
+	return {_buffer, GLintptr(offset), _data+offset};
+}
+
+void PersistentRingBuffer::createBuffer(size_t regionSize) {
+	// the old fences guarded the regions of the old buffer
+	for(GLsync& f : _fences)
+		if(f) {
+			glDeleteSync(f);
+			f = nullptr;
+		}
+	_regionSize = regionSize;
+	_regionUsed = 0;
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	glGenBuffers(1, &_buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, _buffer);
+	glBufferStorage(GL_COPY_WRITE_BUFFER, FRAME_COUNT*_regionSize, nullptr, flags);
+	_data = static_cast<char*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, FRAME_COUNT*_regionSize, flags));
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	if(!_data)
+		std::cerr << "Failed to map the frame upload buffer\n";
+}
+
+PersistentRingBuffer& frameUploadBuffer() {
+	static PersistentRingBuffer* rb = new PersistentRingBuffer(FRAME_UPLOAD_REGION_SIZE);
+	return *rb;
+}
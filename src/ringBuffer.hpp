@@ -0,0 +1,69 @@
+/** @file */
+#ifndef RINGBUFFER_HPP_26_10_19_20_03_15
+#define RINGBUFFER_HPP_26_10_19_20_03_15
+#include <vector>
+#include "libs.hpp"
+
+/** Persistently mapped buffer for the data uploaded every frame (uniforms, indirect draw commands, HUD vertices).
+ * The buffer is split into one region per frame in flight and the data is written directly into the mapped memory,
+ * so there are no driver copies and no implicit synchronization.
+ * A region is reused only after the fence placed at the end of its frame has signaled.
+ * If a frame does not fit, a larger buffer is created and the old one is deleted once the GPU is done with it.
+ */
+class PersistentRingBuffer {
+	public:
+		/** Space in the buffer which can be written until the end of the frame.
+		 */
+		struct Allocation {
+			GLuint buffer;
+			GLintptr offset;
+			void* data;
+		};
+
+		static const unsigned FRAME_COUNT = 3;
+
+		PersistentRingBuffer(size_t regionSize);
+		~PersistentRingBuffer();
+
+		PersistentRingBuffer(const PersistentRingBuffer&) = delete;
+		PersistentRingBuffer& operator=(const PersistentRingBuffer&) = delete;
+
+		/** Switches to the next region, waiting until the GPU has finished the frame which used it.
+		 */
+		void beginFrame();
+
+		/** Places the fence of the current region, the allocations must not be written afterwards.
+		 */
+		void endFrame();
+
+		/** The offset is a multiple of the alignment, which must be a power of two.
+		 */
+		Allocation allocate(size_t size, size_t alignment);
+
+	private:
+		struct RetiredBuffer {
+			GLuint buffer;
+			GLsync fence; /// placed at the end of the frame in which the buffer was replaced
+		};
+
+		void createBuffer(size_t regionSize);
+
+		GLuint _buffer;
+		char* _data;
+		size_t _regionSize;
+		unsigned _region;
+		size_t _regionUsed;
+		GLsync _fences[FRAME_COUNT];
+		std::vector<RetiredBuffer> _retiredBuffers;
+};
+
+/** The ring buffer shared by all per-frame uploads, it lives as long as the GL context.
+ * Application::display begins and ends its frames.
+ */
+PersistentRingBuffer& frameUploadBuffer();
+
+/** Blocks until the fence has signaled, flushing the commands before it.
+ */
+void waitForFence(GLsync fence);
+
+#endif /* RINGBUFFER_HPP_26_10_19_20_03_15 */
@@ -1,11 +1,47 @@
 #include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <GL/glew.h>
 #include <glm/gtc/matrix_access.hpp>
 #include "scene.hpp"
 #include "utils.hpp"
 #include "globals.hpp"
+#include "ringBuffer.hpp"
 
-Scene::Scene() {
+static const unsigned OCCLUSION_BUFFER_WIDTH = 256;
+static const unsigned OCCLUSION_BUFFER_HEIGHT = 256;
+static const GLuint FRAME_UNIFORM_BINDING = 0; // binding of the Frame uniform block in the shaders
+static const GLuint OBJECT_STORAGE_BINDING = 4; // binding of the Objects storage block (0-3 are used by GPUFrustumCuller)
+static const GLuint MATERIAL_STORAGE_BINDING = 5; // binding of the Materials storage block
+
+namespace {
+	/** std140 layout of the Frame uniform block.
+	 */
+	struct FrameUniforms {
+		glm::mat4 viewProject;
+		glm::vec4 cameraPos;
+	};
+
+	/** std430 layout of one element of the Objects storage block.
+	 */
+	struct ObjectUniforms {
+		glm::mat4 model;
+		glm::mat4 modelInvT;
+		GLuint firstMaterial;
+		GLuint materialPadding[3];
+		glm::vec3 positionOffset;
+		GLuint octahedralNormals;
+		glm::vec3 positionScale;
+		float padding;
+	};
+}
+
+Scene::Scene():
+	_predictedCameraValid{false},
+	_viewportHeight{1},
+	_occlusionBuffer{OCCLUSION_BUFFER_WIDTH, OCCLUSION_BUFFER_HEIGHT}
+{
 	// load and prepare shaders
 	_program = loadShaderProgram({
 			{ GL_VERTEX_SHADER, "../data/shaders/pt.vert" },
@@ -13,21 +49,41 @@ Scene::Scene() {
 			});
 	if(!_program)
 		std::cerr << "Failed to load shader program\n";
+	_objectIndexLoc = glGetUniformLocation(_program, "ObjectIndex");
+	if(_objectIndexLoc == -1)
+		std::cerr << "Uniform ObjectIndex not found.\n";
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &_uniformBufferAlignment);
+	glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &_storageBufferAlignment);
 }
 
 void Scene::render() {
 	glUseProgram(_program);
-	// set uniforms
-	GLint camPosLoc = glGetUniformLocation(_program, "CameraPos");
-	if(camPosLoc == -1)
-		std::cerr << "Could not set uniform value CameraPos - uniform not found.\n";
-	glUniform3fv(camPosLoc, 1, glm::value_ptr(_camera.getPosition()));
-
-	setUniform(_program, _camera.getViewProjection(), "ViewProject");
+	// per-frame and per-object uniforms are written directly into the mapped upload buffer
+	PersistentRingBuffer::Allocation a = frameUploadBuffer().allocate(sizeof(FrameUniforms), _uniformBufferAlignment);
+	*static_cast<FrameUniforms*>(a.data) = {_camera.getViewProjection(), glm::vec4(_camera.getPosition(), 1)};
+	glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_UNIFORM_BINDING, a.buffer, a.offset, sizeof(FrameUniforms));
+	if(!_objects.empty()) {
+		size_t size = _objects.size()*sizeof(ObjectUniforms);
+		a = frameUploadBuffer().allocate(size, _storageBufferAlignment);
+		ObjectUniforms* objectUniforms = static_cast<ObjectUniforms*>(a.data);
+		// the materials of all objects are in one array, each object indexes it from its first material
+		GLuint materialCount = 0;
+		for(Object& o : _objects) {
+			*objectUniforms++ = {o.getTransform(), glm::transpose(glm::inverse(o.getTransform())), materialCount, {0, 0, 0}, o._positionOffset, o._compressedVertices, o._positionScale, 0};
+			materialCount += o.getMaterials().size();
+		}
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, OBJECT_STORAGE_BINDING, a.buffer, a.offset, size);
+		size = materialCount*sizeof(Material);
+		a = frameUploadBuffer().allocate(size, _storageBufferAlignment);
+		Material* materials = static_cast<Material*>(a.data);
+		for(Object& o : _objects)
+			materials = std::copy(o.getMaterials().begin(), o.getMaterials().end(), materials);
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, MATERIAL_STORAGE_BINDING, a.buffer, a.offset, size);
+	}
 
-	float n = _camera.getNear();
-	float f = _camera.getFar();
-	glm::vec3 frustumCenterWorld = _camera.getPosition() + _camera.getLookDir()*(n + (f-n)/2);
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	_viewportHeight = viewport[3];
 
 	if(BF_CULLING_ENABLED) {
 		glEnable(GL_CULL_FACE);
@@ -36,28 +92,25 @@ void Scene::render() {
 	else
 		glDisable(GL_CULL_FACE);
 	glEnable(GL_DEPTH_TEST);
-	// draw objects
-	for(Object& o : _objects) {
-		glm::mat4 modelInverse = glm::inverse(o.getTransform());
-		glm::mat4 modelInverseT = glm::transpose(modelInverse);
-		setUniform(_program, o.getTransform(), "Model");
-		setUniform(_program, modelInverseT, "ModelInvT");
-
-		const Material& m = o.getMaterial();
-		glUniform4fv(glGetUniformLocation(_program, "Mat.color"), 1, &m.color.r);
-		glUniform1f(glGetUniformLocation(_program, "Mat.ambientK"), m.ambientK);
-		glUniform1f(glGetUniformLocation(_program, "Mat.diffuseK"), m.diffuseK);
-		glUniform1f(glGetUniformLocation(_program, "Mat.specularK"), m.specularK);
-		glUniform1f(glGetUniformLocation(_program, "Mat.shininess"), m.shininess);
-
-		glm::mat4 mvp = _camera.getViewProjection()*o.getTransform();
+	if(OCCLUSION_CULLING_ENABLED)
+		_occlusionBuffer.clear();
+	// draw objects, all of them share the program and the bound blocks, only the object index changes
+	for(unsigned i = 0; i < _objects.size(); ++i) {
+		Object& o = _objects[i];
+		glUniform1ui(_objectIndexLoc, i);
+
+		// objects drawn later are also occluded by the occluders of the objects drawn before
+		Frustum nextFrustum;
+		if(_predictedCameraValid)
+			nextFrustum = modelSpaceFrustum(o, _predictedCamera.getViewProjection(), _predictedCamera.getPosition(), _predictedCamera.getLookDir(), _predictedCamera.getUpVector());
 		o.draw(
-				viewFrustumPlanesFromProjMat(mvp),
-				glm::vec3(glm::vec4(frustumCenterWorld, 1)*modelInverse),
-				glm::vec3(glm::vec4(_camera.getLookDir(), 0)*modelInverseT),
-				glm::vec3(glm::vec4(_camera.getUpVector(), 0)*modelInverseT),
+				modelSpaceFrustum(o, _camera.getViewProjection(), _camera.getPosition(), _camera.getLookDir(), _camera.getUpVector()),
+				OCCLUSION_CULLING_ENABLED ? &_occlusionBuffer : nullptr,
+				_predictedCameraValid ? &nextFrustum : nullptr,
 				true
 				);
+		if(MULTI_VIEW_COUNT > 1)
+			benchmarkMultiViewCulling(o);
 	}
 }
 
@@ -73,6 +126,13 @@ float Scene::totalObjectGPUDrawTime() const {
 	return drawTime;
 }
 
+float Scene::totalObjectLodDrawTime() const {
+	float drawTime = 0;
+	for(const Object& o : _objects)
+		drawTime += o.getLodDrawTime();
+	return drawTime;
+}
+
 unsigned Scene::totalObjectTrianglesRendered() const {
 	unsigned triCount = 0;
 	for(const Object& o : _objects)
@@ -91,6 +151,63 @@ Camera& Scene::getCamera() {
 	return _camera;
 }
 
+void Scene::setPredictedCamera(const Camera& camera) {
+	_predictedCamera = camera;
+	_predictedCameraValid = true;
+}
+
+void Scene::clearPredictedCamera() {
+	_predictedCameraValid = false;
+}
+
+Frustum Scene::modelSpaceFrustum(const Object& o, const glm::mat4& viewProjection, const glm::vec3& position, const glm::vec3& lookDir, const glm::vec3& up) {
+	glm::mat4 modelInverse = glm::inverse(o.getTransform());
+	glm::mat4 modelInverseT = glm::transpose(modelInverse);
+	float n = _camera.getNear();
+	float f = _camera.getFar();
+	glm::vec3 frustumCenterWorld = position + lookDir*(n + (f-n)/2);
+	return {
+		CAMERA_RELATIVE_CULLING_ENABLED
+			? cameraRelativeFrustumPlanes(o, position, lookDir, up)
+			: viewFrustumPlanesFromProjMat(viewProjection*o.getTransform()),
+		glm::vec3(glm::vec4(frustumCenterWorld, 1)*modelInverse),
+		glm::vec3(glm::vec4(lookDir, 0)*modelInverseT),
+		glm::vec3(glm::vec4(up, 0)*modelInverseT),
+		glm::vec3(modelInverse*glm::vec4(position, 1)),
+		_viewportHeight/(2*std::tan(_camera.getFOV()/2)),
+		viewProjection*o.getTransform(),
+	};
+}
+
+void Scene::benchmarkMultiViewCulling(Object& o) {
+	unsigned viewCount = std::min(MULTI_VIEW_COUNT, MAX_FRUSTUMS_PER_TRAVERSAL);
+	std::vector<Frustum> frustums;
+	for(unsigned i = 0; i < viewCount; ++i) {
+		// the views overlap (as stereo pairs or shadow cascades do) and together span twice the camera FOV
+		float angle = _camera.getFOV()*(float(i)/(viewCount-1) - 0.5f);
+		glm::vec3 lookDir = glm::rotate(_camera.getLookDir(), angle, _camera.getUpVector());
+		glm::vec3 pos = _camera.getPosition();
+		glm::mat4 viewProjection = _camera.getProjection()*glm::lookAt(pos, pos+lookDir, _camera.getUpVector());
+		frustums.push_back(modelSpaceFrustum(o, viewProjection, pos, lookDir, _camera.getUpVector()));
+	}
+
+	// the counters and the plane coherency state belong to the rendered view
+	TraversalCounters renderedViewCounters = TraversalCounters::take();
+	std::vector<uint8_t> frustumTestPlanes = o._bvh.getFrustumTestPlanes();
+	static std::vector<std::vector<unsigned>> visibleNodes;
+	auto start = std::chrono::steady_clock::now();
+	o._bvh.nodesInFrustums(frustums, visibleNodes);
+	FC_MULTI_VIEW_TRAVERSE_TIME += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now()-start).count()/1000.f;
+
+	start = std::chrono::steady_clock::now();
+	for(const Frustum& f : frustums)
+		o._bvh.nodesInFrustum(f);
+	FC_INDEPENDENT_VIEWS_TRAVERSE_TIME += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now()-start).count()/1000.f;
+	o._bvh.setFrustumTestPlanes(frustumTestPlanes);
+	TraversalCounters::take();
+	renderedViewCounters.add();
+}
+
 std::vector<Plane> Scene::viewFrustumPlanesFromProjMat(const glm::mat4& mat) {
 	using namespace glm;
 	std::vector<Plane> planes(6);
@@ -105,3 +222,24 @@ std::vector<Plane> Scene::viewFrustumPlanesFromProjMat(const glm::mat4& mat) {
 		normalizePlane(p);
 	return planes;
 }
+
+std::vector<Plane> Scene::cameraRelativeFrustumPlanes(const Object& o, const glm::vec3& position, const glm::vec3& lookDir, const glm::vec3& up) {
+	using namespace glm;
+	dmat4 mat = _camera.getProjectionD()*lookAt(dvec3(0), dvec3(lookDir), dvec3(up));
+	dvec4 rows[6];
+	rows[Left]  = row(mat,3) + row(mat,0);
+	rows[Right] = row(mat,3) - row(mat,0);
+	rows[Bot]   = row(mat,3) + row(mat,1);
+	rows[Top]   = row(mat,3) - row(mat,1);
+	rows[Near]  = row(mat,3) + row(mat,2);
+	rows[Far]   = row(mat,3) - row(mat,2);
+	// the object transform is only a translation, model space point x is at x + offset relative to the camera
+	dvec3 offset = dvec3(o.getPosition()) - dvec3(position);
+	std::vector<Plane> planes(6);
+	for(unsigned i = 0; i < 6; ++i) {
+		dvec4 p = rows[i]/length(dvec3(rows[i]));
+		p.w += dot(dvec3(p), offset);
+		planes[i] = Plane(p);
+	}
+	return planes;
+}
@@ -19,6 +19,10 @@ class Scene {
 		 */
 		float totalObjectGPUDrawTime() const;
 
+		/** Returns the part of totalObjectGPUDrawTime spent drawing the node proxies.
+		 */
+		float totalObjectLodDrawTime() const;
+
 		/** Returns the number of triangles that were sent for rendering in the last frame.
 		 */
 		unsigned totalObjectTrianglesRendered() const;
@@ -29,7 +33,22 @@ class Scene {
 
 		Camera& getCamera();
 
+		/** Sets the camera expected in the next frame, the objects then cull its view speculatively.
+		 */
+		void setPredictedCamera(const Camera& camera);
+		void clearPredictedCamera();
+
 	private:
+		/** Returns culling frustum of the given view in the model space of the object.
+		 */
+		Frustum modelSpaceFrustum(const Object& o, const glm::mat4& viewProjection, const glm::vec3& position, const glm::vec3& lookDir, const glm::vec3& up);
+
+		/** Culls MULTI_VIEW_COUNT views fanned horizontally around the camera view,
+		 * once in a single BVH traversal and once using an independent traversal per view.
+		 * Only the culling times are measured, nothing is drawn.
+		 */
+		void benchmarkMultiViewCulling(Object& o);
+
 		/**
 		 * Calculates view frustum planes from given projection matrix.
 		 * If the matrix is a view-projection matrix, then the planes are in world space.
@@ -42,8 +61,22 @@ class Scene {
 		 */
 		std::vector<Plane> viewFrustumPlanesFromProjMat(const glm::mat4& proj);
 
+		/** Calculates the planes of the camera view in the model space of the object like viewFrustumPlanesFromProjMat,
+		 * but in double precision and with the view centered at the camera, so that the huge far to near ratio
+		 * and large world coordinates do not cancel out the plane coefficients.
+		 * Only the final plane distances are large, they are rounded to float once.
+		 */
+		std::vector<Plane> cameraRelativeFrustumPlanes(const Object& o, const glm::vec3& position, const glm::vec3& lookDir, const glm::vec3& up);
+
 		std::vector<Object> _objects;
 		Camera _camera;
+		Camera _predictedCamera;
+		bool _predictedCameraValid;
 		GLuint _program;
+		GLint _objectIndexLoc; /// index into the Objects storage block
+		GLint _uniformBufferAlignment;
+		GLint _storageBufferAlignment;
+		float _viewportHeight;
+		OcclusionBuffer _occlusionBuffer;
 };
 #endif /* SCENE_HPP_19_04_21_09_17_56 */
@@ -1,8 +1,10 @@
+#include <algorithm>
 #include <iostream>
 #include <GL/glew.h>
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include "utils.hpp"
+#include "ringBuffer.hpp"
 #include "ft2build.h"
 #include "text.hpp"
 // the FT_FREETYPE_H macro uses <> so the linter cannot find the header unless it scans the entire src dir recursively
@@ -21,10 +23,17 @@ void FontRenderer::RenderText(std::string text, GLfloat initX, GLfloat initY, GL
 					y = initY;
 	// Activate corresponding render state	
 	glUseProgram(_shaderProgram);
-	glUniform3f(glGetUniformLocation(_shaderProgram, "textColor"), color.x, color.y, color.z);
+	glUniform3f(_textColorLoc, color.x, color.y, color.z);
 	glActiveTexture(GL_TEXTURE0);
 	glBindVertexArray(VAO);
 
+	// the quads of all glyphs are written directly into the mapped upload buffer
+	const GLsizei vertexSize = 4*sizeof(GLfloat);
+	PersistentRingBuffer::Allocation a = frameUploadBuffer().allocate(text.size()*6*vertexSize, vertexSize);
+	GLfloat (*quads)[6][4] = static_cast<GLfloat (*)[6][4]>(a.data);
+	glBindVertexBuffer(0, a.buffer, a.offset, vertexSize);
+	GLint firstVertex = 0;
+
 	// Iterate through all characters
 	std::string::const_iterator c;
 	for (c = text.begin(); c != text.end(); c++)
@@ -42,7 +51,6 @@ void FontRenderer::RenderText(std::string text, GLfloat initX, GLfloat initY, GL
 
 		GLfloat w = ch.Size.x * scale;
 		GLfloat h = ch.Size.y * scale;
-		// Update VBO for each character
 		GLfloat vertices[6][4] = {
 			{ xpos,     ypos + h,   0.0, 0.0 },            
 			{ xpos,     ypos,       0.0, 1.0 },
@@ -52,14 +60,11 @@ void FontRenderer::RenderText(std::string text, GLfloat initX, GLfloat initY, GL
 			{ xpos + w, ypos,       1.0, 1.0 },
 			{ xpos + w, ypos + h,   1.0, 0.0 }           
 		};
+		std::copy(&vertices[0][0], &vertices[0][0]+6*4, &(*quads++)[0][0]);
 		// Render glyph texture over quad
 		glBindTexture(GL_TEXTURE_2D, ch.TextureID);
-		// Update content of VBO memory
-		glBindBuffer(GL_ARRAY_BUFFER, VBO);
-		glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices); 
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
-		// Render quad
-		glDrawArrays(GL_TRIANGLES, 0, 6);
+		glDrawArrays(GL_TRIANGLES, firstVertex, 6);
+		firstVertex += 6;
 		// Now advance cursors for next glyph (note that advance is number of 1/64 pixels)
 		x += (ch.Advance >> 6) * scale; // Bitshift by 6 to get value in pixels (2^6 = 64)
 	}
@@ -134,13 +139,12 @@ void FontRenderer::initGL() {
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);  
 
+	// the vertex buffer is bound in RenderText, the vertices are in the frame upload buffer
 	glGenVertexArrays(1, &VAO);
-	glGenBuffers(1, &VBO);
 	glBindVertexArray(VAO);
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * 6 * 4, NULL, GL_DYNAMIC_DRAW);
 	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), 0);
+	glVertexAttribFormat(0, 4, GL_FLOAT, GL_FALSE, 0);
+	glVertexAttribBinding(0, 0);
 
 	_shaderProgram = loadShaderProgram({
 			{ GL_VERTEX_SHADER, "../data/shaders/text.vert" },
@@ -148,7 +152,7 @@ void FontRenderer::initGL() {
 			});
 	if(!_shaderProgram)
 		std::cerr << "Failed to load shader program\n";
+	_textColorLoc = glGetUniformLocation(_shaderProgram, "textColor");
 
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindVertexArray(0);  
 }
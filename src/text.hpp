@@ -37,8 +37,8 @@ class FontRenderer {
 
 		Characters _characters;
 		GLuint VAO;
-		GLuint VBO;
 		GLuint _shaderProgram;
+		GLint _textColorLoc;
 		glm::mat4 _projection;
 };
 #endif /* TEXT_HPP_18_12_31_16_48_03 */
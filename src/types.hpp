@@ -4,6 +4,7 @@
 
 #include <sstream>
 #include <limits>
+#include <vector>
 #include "libs.hpp"
 
 struct Color {
@@ -21,11 +22,29 @@ struct Material {
 	GLfloat shininess;
 };
 
+/** Layout of one command in the GL_DRAW_INDIRECT_BUFFER used by glMultiDrawElementsIndirect.
+ */
+struct DrawElementsIndirectCommand {
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+};
+
 struct Vertex {
 	glm::vec3 position;
 	glm::vec3 normal;
 };
 
+/** Vertex with the position quantized to 16 bits in the bounds of the object
+ * and the normal octahedral-encoded into two 16 bit snorms (see VERTEX_COMPRESSION_ENABLED).
+ */
+struct CompressedVertex {
+	GLushort position[4]; /// the fourth component only keeps the normal 4-byte aligned
+	GLshort normal[2];
+};
+
 struct AABB {
 	glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
 	glm::vec3 max = glm::vec3(std::numeric_limits<float>::lowest());
@@ -96,4 +115,21 @@ enum FrustumPlane {
 	Near,
 	Far,
 };
+
+/** View frustum used for culling.
+ * Besides the planes it contains the data needed by the octant test.
+ * All members must be in the same space as the culled geometry (model space).
+ */
+struct Frustum {
+	std::vector<Plane> planes;
+	glm::vec3 center;
+	glm::vec3 lookDir;
+	glm::vec3 up;
+	glm::vec3 viewPoint;
+	/** Size in pixels of an object with unit size at unit distance from the view point.
+	 * (viewport height / (2*tan(fov/2)))
+	 */
+	float projectionScale;
+	glm::mat4 modelViewProjection;
+};
 #endif /* TYPES_HPP_18_12_30_14_55_14 */
@@ -0,0 +1,131 @@
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <unordered_map>
+#include "vertexCache.hpp"
+
+static const int LRU_CACHE_SIZE = 32; // simulated by the optimizer
+static const float LAST_TRIANGLE_SCORE = 0.75f; // vertices of the last triangle, lower so that strips do not stay in one direction
+static const float CACHE_DECAY_POWER = 1.5f;
+static const float VALENCE_BOOST_SCALE = 2.0f;
+static const float VALENCE_BOOST_POWER = 0.5f;
+
+namespace {
+	struct CacheVertex {
+		int cachePosition = -1; /// -1 if the vertex is not in the cache
+		float score = 0;
+		unsigned firstTriangle = 0; /// into the vertex triangle lists
+		unsigned activeTriangleCount = 0; /// the first activeTriangleCount triangles of the list are not added yet
+	};
+
+	float vertexScore(const CacheVertex& v) {
+		if(v.activeTriangleCount == 0)
+			return -1;
+		float score = 0;
+		if(v.cachePosition >= 0) {
+			if(v.cachePosition < 3)
+				score = LAST_TRIANGLE_SCORE;
+			else
+				score = std::pow(1 - float(v.cachePosition-3)/(LRU_CACHE_SIZE-3), CACHE_DECAY_POWER);
+		}
+		return score + VALENCE_BOOST_SCALE*std::pow(float(v.activeTriangleCount), -VALENCE_BOOST_POWER);
+	}
+}
+
+std::vector<unsigned> vertexCacheOptimizedOrder(const std::vector<unsigned>& indices) {
+	unsigned triangleCount = indices.size()/3;
+	// the vertices are renumbered, so that the arrays are proportional to the size of the triangle list
+	std::unordered_map<unsigned, unsigned> vertexIDs;
+	std::vector<unsigned> triangleVertices(indices.size());
+	for(unsigned i = 0; i < indices.size(); ++i)
+		triangleVertices[i] = vertexIDs.emplace(indices[i], vertexIDs.size()).first->second;
+	std::vector<CacheVertex> vertices(vertexIDs.size());
+	for(unsigned v : triangleVertices)
+		++vertices[v].activeTriangleCount;
+	unsigned first = 0;
+	for(CacheVertex& v : vertices) {
+		v.firstTriangle = first;
+		first += v.activeTriangleCount;
+		v.activeTriangleCount = 0;
+	}
+	std::vector<unsigned> vertexTriangles(indices.size());
+	for(unsigned i = 0; i < triangleVertices.size(); ++i) {
+		CacheVertex& v = vertices[triangleVertices[i]];
+		vertexTriangles[v.firstTriangle + v.activeTriangleCount++] = i/3;
+	}
+	for(CacheVertex& v : vertices)
+		v.score = vertexScore(v);
+	std::vector<float> triangleScores(triangleCount, 0);
+	for(unsigned i = 0; i < triangleVertices.size(); ++i)
+		triangleScores[i/3] += vertices[triangleVertices[i]].score;
+
+	std::vector<bool> triangleAdded(triangleCount, false);
+	std::vector<unsigned> order;
+	order.reserve(triangleCount);
+	std::vector<unsigned> cache, newCache;
+	unsigned nextUnadded = 0; // used if no triangle of the cached vertices remains
+	int bestTriangle = -1;
+	while(order.size() < triangleCount) {
+		if(bestTriangle < 0) {
+			while(triangleAdded[nextUnadded])
+				++nextUnadded;
+			bestTriangle = nextUnadded;
+		}
+		unsigned t = bestTriangle;
+		triangleAdded[t] = true;
+		order.push_back(t);
+
+		// remove the triangle from the active lists of its vertices and move them to the front of the cache
+		newCache.clear();
+		for(unsigned c = 0; c < 3; ++c) {
+			unsigned vi = triangleVertices[t*3+c];
+			CacheVertex& v = vertices[vi];
+			unsigned* list = &vertexTriangles[v.firstTriangle];
+			std::swap(*std::find(list, list+v.activeTriangleCount, t), list[v.activeTriangleCount-1]);
+			--v.activeTriangleCount;
+			newCache.push_back(vi);
+		}
+		for(unsigned vi : cache)
+			if(std::find(newCache.begin(), newCache.begin()+3, vi) == newCache.begin()+3)
+				newCache.push_back(vi);
+		std::swap(cache, newCache);
+
+		// rescore the vertices whose cache position changed (including the evicted ones) and their remaining triangles
+		for(unsigned i = 0; i < cache.size(); ++i) {
+			CacheVertex& v = vertices[cache[i]];
+			v.cachePosition = int(i) < LRU_CACHE_SIZE ? i : -1;
+			float score = vertexScore(v);
+			for(unsigned j = v.firstTriangle; j < v.firstTriangle + v.activeTriangleCount; ++j)
+				triangleScores[vertexTriangles[j]] += score - v.score;
+			v.score = score;
+		}
+		if(cache.size() > unsigned(LRU_CACHE_SIZE))
+			cache.resize(LRU_CACHE_SIZE);
+		// the next triangle is the best one using a cached vertex
+		bestTriangle = -1;
+		float bestScore = -1;
+		for(unsigned vi : cache) {
+			const CacheVertex& v = vertices[vi];
+			for(unsigned j = v.firstTriangle; j < v.firstTriangle + v.activeTriangleCount; ++j)
+				if(triangleScores[vertexTriangles[j]] > bestScore) {
+					bestScore = triangleScores[vertexTriangles[j]];
+					bestTriangle = vertexTriangles[j];
+				}
+		}
+	}
+	return order;
+}
+
+unsigned vertexCacheMissCount(const std::vector<unsigned>& indices, unsigned cacheSize) {
+	std::deque<unsigned> cache;
+	unsigned missCount = 0;
+	for(unsigned i : indices) {
+		if(std::find(cache.begin(), cache.end(), i) != cache.end())
+			continue;
+		++missCount;
+		cache.push_back(i);
+		if(cache.size() > cacheSize)
+			cache.pop_front();
+	}
+	return missCount;
+}
@@ -0,0 +1,19 @@
+/** @file */
+#ifndef VERTEXCACHE_HPP_26_10_19_21_14_08
+#define VERTEXCACHE_HPP_26_10_19_21_14_08
+#include <vector>
+
+/** Returns the triangle order which reduces the post-transform vertex cache misses of the indexed triangle list (three indices per triangle).
+ * Triangles are added greedily by the score of their vertices, which favours vertices in the simulated LRU cache and vertices with few remaining triangles.
+ *
+ * source article: Linear-Speed Vertex Cache Optimisation (Tom Forsyth)
+ */
+std::vector<unsigned> vertexCacheOptimizedOrder(const std::vector<unsigned>& indices);
+
+/** Returns the number of vertices which miss the simulated FIFO post-transform cache of cacheSize entries
+ * when the triangles are drawn in the order of the indices.
+ * Divided by the triangle count it gives the average cache miss ratio (ACMR).
+ */
+unsigned vertexCacheMissCount(const std::vector<unsigned>& indices, unsigned cacheSize);
+
+#endif /* VERTEXCACHE_HPP_26_10_19_21_14_08 */
@@ -0,0 +1,145 @@
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include "visibleSetCache.hpp"
+
+static const float POSITION_QUANTUM = 0.01f; // [model space units]
+static const float DIRECTION_QUANTUM = 1e-4f;
+
+template<typename T>
+static void writeRaw(std::ostream& os, const T& v) {
+	os.write(reinterpret_cast<const char*>(&v), sizeof(T));
+}
+
+template<typename T>
+static bool readRaw(std::istream& is, T& v) {
+	return bool(is.read(reinterpret_cast<char*>(&v), sizeof(T)));
+}
+
+static void writeRanges(std::ostream& os, const std::vector<NodePrimitives>& ranges) {
+	writeRaw<uint32_t>(os, ranges.size());
+	for(const NodePrimitives& r : ranges) {
+		writeRaw<uint32_t>(os, r.first);
+		writeRaw<uint32_t>(os, r.count);
+	}
+}
+
+/** Fails if the ranges do not fit in the rest of the file or reference primitives past primitiveCount.
+ */
+static bool readRanges(std::istream& is, size_t fileSize, std::vector<NodePrimitives>& ranges, unsigned primitiveCount) {
+	uint32_t count;
+	if(!readRaw(is, count) || count > (fileSize - size_t(is.tellg()))/(2*sizeof(uint32_t)))
+		return false;
+	ranges.resize(count);
+	for(NodePrimitives& r : ranges) {
+		uint32_t first, rangeCount;
+		if(!readRaw(is, first) || !readRaw(is, rangeCount) || first > primitiveCount || rangeCount > primitiveCount - first)
+			return false;
+		r = {first, rangeCount};
+	}
+	return true;
+}
+
+VisibleSetCache::VisibleSetCache():
+	_memoryBudget{0},
+	_memoryUsage{0}
+{}
+
+VisibleSetCache::Key VisibleSetCache::key(const Frustum& frustum, uint32_t settings) {
+	Key k;
+	for(unsigned a = 0; a < 3; ++a) {
+		k[a]   = int32_t(std::floor(frustum.viewPoint[a]/POSITION_QUANTUM));
+		k[3+a] = int32_t(std::floor(frustum.lookDir[a]/DIRECTION_QUANTUM));
+		k[6+a] = int32_t(std::floor(frustum.up[a]/DIRECTION_QUANTUM));
+	}
+	std::memcpy(&k[9], &frustum.projectionScale, sizeof(int32_t));
+	k[10] = int32_t(settings);
+	return k;
+}
+
+const VisibleSet* VisibleSetCache::find(const Key& key) {
+	auto it = _index.find(key);
+	if(it == _index.end())
+		return nullptr;
+	_entries.splice(_entries.begin(), _entries, it->second);
+	return &it->second->set;
+}
+
+void VisibleSetCache::insert(const Key& key, const VisibleSet& set) {
+	auto it = _index.find(key);
+	if(it != _index.end()) {
+		_memoryUsage -= entrySize(it->second->set);
+		_entries.erase(it->second);
+		_index.erase(it);
+	}
+	_entries.push_front({key, set});
+	_index[key] = _entries.begin();
+	_memoryUsage += entrySize(set);
+	evict();
+}
+
+void VisibleSetCache::setMemoryBudget(size_t bytes) {
+	_memoryBudget = bytes;
+	evict();
+}
+
+size_t VisibleSetCache::getMemoryUsage() const {
+	return _memoryUsage;
+}
+
+bool VisibleSetCache::save(const std::string& fileName, unsigned bvhNodeCount, uint32_t signature) const {
+	std::ofstream of(fileName, std::ios::binary);
+	if(!of)
+		return false;
+	of.write("VSC2", 4);
+	writeRaw<uint32_t>(of, bvhNodeCount);
+	writeRaw<uint32_t>(of, signature);
+	writeRaw<uint32_t>(of, _entries.size());
+	for(const Entry& e : _entries) {
+		for(int32_t k : e.key)
+			writeRaw<int32_t>(of, k);
+		writeRanges(of, e.set.ranges);
+		writeRanges(of, e.set.proxyRanges);
+	}
+	return bool(of);
+}
+
+bool VisibleSetCache::load(const std::string& fileName, unsigned bvhNodeCount, uint32_t signature, unsigned primitiveCount, unsigned proxyPrimitiveCount) {
+	std::ifstream ifile(fileName, std::ios::binary | std::ios::ate);
+	size_t fileSize = ifile ? size_t(ifile.tellg()) : 0;
+	ifile.seekg(0);
+	char magic[4];
+	uint32_t nodeCount, fileSignature, entryCount;
+	if(!ifile.read(magic, 4) || std::string(magic, 4) != "VSC2"
+			|| !readRaw(ifile, nodeCount) || !readRaw(ifile, fileSignature) || !readRaw(ifile, entryCount)
+			|| nodeCount != bvhNodeCount || fileSignature != signature
+			// each set has at least its key and two range counts
+			|| entryCount > (fileSize - size_t(ifile.tellg()))/(sizeof(Key) + 2*sizeof(uint32_t)))
+		return false;
+	std::vector<Entry> entries(entryCount);
+	for(Entry& e : entries) {
+		for(int32_t& k : e.key)
+			if(!readRaw(ifile, k))
+				return false;
+		if(!readRanges(ifile, fileSize, e.set.ranges, primitiveCount) || !readRanges(ifile, fileSize, e.set.proxyRanges, proxyPrimitiveCount))
+			return false;
+	}
+	// the least recently used first, so that the budget evicts the same sets as it would have before saving
+	for(auto it = entries.rbegin(); it != entries.rend(); ++it)
+		insert(it->key, it->set);
+	return true;
+}
+
+size_t VisibleSetCache::entrySize(const VisibleSet& set) {
+	// the list and map nodes are counted as well
+	return sizeof(Entry) + 8*sizeof(void*) + (set.ranges.size() + set.proxyRanges.size())*sizeof(NodePrimitives);
+}
+
+void VisibleSetCache::evict() {
+	while(_memoryUsage > _memoryBudget && !_entries.empty()) {
+		const Entry& e = _entries.back();
+		_memoryUsage -= entrySize(e.set);
+		_index.erase(e.key);
+		_entries.pop_back();
+	}
+}
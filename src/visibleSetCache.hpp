@@ -0,0 +1,68 @@
+/** @file */
+#ifndef VISIBLESETCACHE_HPP_26_10_19_18_20_07
+#define VISIBLESETCACHE_HPP_26_10_19_18_20_07
+#include <array>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+#include "bvh.hpp"
+
+/** Culling result of one view.
+ */
+struct VisibleSet {
+	std::vector<NodePrimitives> ranges;
+	std::vector<NodePrimitives> proxyRanges; /// ranges of the LOD index buffer
+};
+
+/** LRU cache of culling results keyed by the quantized camera pose (in model space) and the culling settings.
+ * Meant for repeated camera route playbacks, where the same poses are culled again and again.
+ * The least recently used sets are evicted once the memory budget is exceeded.
+ */
+class VisibleSetCache {
+	public:
+		/** Quantized view point, look direction and up vector, projection scale bits and the culling settings hash.
+		 */
+		using Key = std::array<int32_t, 11>;
+
+		VisibleSetCache();
+
+		static Key key(const Frustum& frustum, uint32_t settings);
+
+		/** Returns the cached set and marks it as the most recently used, or nullptr.
+		 */
+		const VisibleSet* find(const Key& key);
+
+		void insert(const Key& key, const VisibleSet& set);
+
+		/** Evicts the least recently used sets until the cache fits.
+		 */
+		void setMemoryBudget(size_t bytes);
+		size_t getMemoryUsage() const;
+
+		/** Binary file: "VSC2", BVH node count, signature, set count,
+		 * then for each set (from the most recently used) its key, range count, ranges, proxy range count and proxy ranges.
+		 * The signature identifies the primitive order, the index buffer layout and the PVS the ranges were culled with.
+		 */
+		bool save(const std::string& fileName, unsigned bvhNodeCount, uint32_t signature) const;
+
+		/** Fails if the file was saved for a BVH with a different node count or with a different signature,
+		 * or if it is truncated or a range references primitives past primitiveCount (proxyPrimitiveCount for the proxy ranges).
+		 */
+		bool load(const std::string& fileName, unsigned bvhNodeCount, uint32_t signature, unsigned primitiveCount, unsigned proxyPrimitiveCount);
+
+	private:
+		struct Entry {
+			Key key;
+			VisibleSet set;
+		};
+
+		static size_t entrySize(const VisibleSet& set);
+		void evict();
+
+		size_t _memoryBudget;
+		size_t _memoryUsage;
+		std::list<Entry> _entries; /// the most recently used first
+		std::map<Key, std::list<Entry>::iterator> _index;
+};
+#endif /* VISIBLESETCACHE_HPP_26_10_19_18_20_07 */
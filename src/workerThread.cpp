@@ -0,0 +1,53 @@
+#include "workerThread.hpp"
+
+WorkerThread::WorkerThread():
+	_busy{false},
+	_quit{false},
+	_thread{&WorkerThread::loop, this}
+{}
+
+WorkerThread::~WorkerThread() {
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_condition.wait(lock, [this]() { return !_busy; });
+		_quit = true;
+	}
+	_condition.notify_all();
+	_thread.join();
+}
+
+void WorkerThread::run(std::function<void()> job) {
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_condition.wait(lock, [this]() { return !_busy; });
+		_job = std::move(job);
+		_busy = true;
+	}
+	_condition.notify_all();
+}
+
+void WorkerThread::wait() {
+	std::unique_lock<std::mutex> lock(_mutex);
+	_condition.wait(lock, [this]() { return !_busy; });
+}
+
+void WorkerThread::loop() {
+	std::unique_lock<std::mutex> lock(_mutex);
+	while(true) {
+		_condition.wait(lock, [this]() { return bool(_job) || _quit; });
+		if(_quit)
+			return;
+		std::function<void()> job = std::move(_job);
+		_job = nullptr;
+		lock.unlock();
+		job();
+		lock.lock();
+		_busy = false;
+		_condition.notify_all();
+	}
+}
+
+WorkerThread& speculativeCullingWorker() {
+	static WorkerThread worker;
+	return worker;
+}
@@ -0,0 +1,42 @@
+/** @file */
+#ifndef WORKERTHREAD_HPP_26_10_20_10_14_52
+#define WORKERTHREAD_HPP_26_10_20_10_14_52
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+/** Thread which runs one job at a time, it is started once and waits for the jobs between them.
+ */
+class WorkerThread {
+	public:
+		WorkerThread();
+		~WorkerThread();
+
+		WorkerThread(const WorkerThread&) = delete;
+		WorkerThread& operator=(const WorkerThread&) = delete;
+
+		/** Starts the job on the thread, waits for the previous job first.
+		 */
+		void run(std::function<void()> job);
+
+		/** Waits until the last job is finished.
+		 */
+		void wait();
+
+	private:
+		void loop();
+
+		std::mutex _mutex;
+		std::condition_variable _condition;
+		std::function<void()> _job; /// empty if there is no job to run
+		bool _busy; /// a job was given and is not finished yet
+		bool _quit;
+		std::thread _thread;
+};
+
+/** The worker shared by the objects for the speculative culling, they use it one after another.
+ */
+WorkerThread& speculativeCullingWorker();
+
+#endif /* WORKERTHREAD_HPP_26_10_20_10_14_52 */